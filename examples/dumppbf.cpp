@@ -22,6 +22,7 @@
 #include <omp.h>
 #endif
 #include <osmpbf/osmfile.h>
+#include <osmpbf/blobfile.h>
 #include <osmpbf/inode.h>
 #include <osmpbf/iway.h>
 #include <osmpbf/irelation.h>
@@ -103,7 +104,10 @@ int main(int argc, char ** argv) {
 	
 	std::string inputFileName(argv[1]);
 
-	osmpbf::OSMFileIn inFile(inputFileName, false);
+	// "-" reads from stdin, which can not be mapped into memory
+	osmpbf::OSMFileIn inFile(inputFileName == "-" ?
+		static_cast<osmpbf::BlobFileIn *>(new osmpbf::BlobStreamIn(inputFileName)) :
+		new osmpbf::BlobFileIn(inputFileName));
 
 	if (!inFile.open()) {
 		std::cout << "Failed to open " <<  inputFileName << std::endl;
@@ -94,7 +94,7 @@ void parseBlock(osmpbf::PrimitiveBlockInputAdaptor & pbi) {
 int main(int argc, char ** argv) {
 	if (argc < 3) {
 		std::cout << "Need parse type and in file" << std::endl;
-		std::cout << "Parse type may be any of s=single threaded,o=OpenMP,c=C++11 Threads" << std::endl;
+		std::cout << "Parse type may be any of s=single threaded,o=OpenMP,c=C++11 Threads,p=single threaded with pipelined decoding" << std::endl;
 	}
 	
 	std::string parseType(argv[1]);
@@ -117,6 +117,10 @@ int main(int argc, char ** argv) {
 	else if (parseType == "c") {
 		osmpbf::parseFileCPPThreads(inFile, parseFunc);
 	}
+	else if (parseType == "p") {
+		inFile.setPipelineMode(std::max<uint32_t>(std::thread::hardware_concurrency(), 1));
+		osmpbf::parseFile(inFile, parseFunc);
+	}
 
 	return 0;
 }
@@ -19,11 +19,14 @@
  */
 
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 
 #include <iostream>
 #include <set>
 
 #include <osmpbf/blobfile.h>
+#include <osmpbf/blobindex.h>
 #include <osmpbf/osmfile.h>
 
 #include <osmpbf/primitiveblockinputadaptor.h>
@@ -98,7 +101,24 @@ int compare(char * inFileName, char * matchFileName, bool verbose) {
 	return match ? 0 : -1;
 }
 
-int copyBlobs(char * inFileName, char * outFileName, bool verbose) {
+struct OutputOptions {
+	osmpbf::BlobCompression compression;
+	int level;
+	uint32_t threads;
+
+	OutputOptions() : compression(osmpbf::COMPRESSION_Zlib), level(-1), threads(0) {}
+};
+
+bool configureOutput(osmpbf::BlobFileOut & outFile, const OutputOptions & options) {
+	if (!outFile.setCompression(options.compression))
+		return false;
+
+	outFile.setCompressionLevel(options.level);
+	outFile.setCompressionThreads(options.threads);
+	return true;
+}
+
+int copyBlobs(char * inFileName, char * outFileName, const OutputOptions & output, bool verbose) {
 	if (!outFileName) {
 		std::cerr << "output file parameter is missing" << std::endl;
 		return -1;
@@ -106,6 +126,8 @@ int copyBlobs(char * inFileName, char * outFileName, bool verbose) {
 
 	osmpbf::BlobFileIn inFile(inFileName);
 	osmpbf::BlobFileOut outFile(outFileName);
+	if (!configureOutput(outFile, output))
+		return -1;
 
 	inFile.setVerboseOutput(verbose);
 	outFile.setVerboseOutput(verbose);
@@ -409,7 +431,7 @@ int dumpMatch(char * inputFileName, char * matchString, bool verbose) {
 	return 0;
 }
 
-int extract(const char * inputFileName, const char * outputFileName, const char * matchString, bool verbose) {
+int extract(const char * inputFileName, const char * outputFileName, const char * matchString, const OutputOptions & output, bool verbose) {
 	if (!matchString) {
 		std::cerr << "ERROR: no match string supplied" << std::endl;
 		return -1;
@@ -422,6 +444,8 @@ int extract(const char * inputFileName, const char * outputFileName, const char
 
 	osmpbf::BlobFileIn inFile(inputFileName);
 	osmpbf::BlobFileOut outFile(outputFileName);
+	if (!configureOutput(outFile, output))
+		return -1;
 
 	osmpbf::BlobDataBuffer buffer;
 
@@ -474,7 +498,7 @@ int extract(const char * inputFileName, const char * outputFileName, const char
 	return 0;
 }
 
-int extractWays(const char * inputFileName, const char * outputFileName, bool verbose) {
+int extractWays(const char * inputFileName, const char * outputFileName, const OutputOptions & output, bool verbose) {
 	if (!outputFileName) {
 		std::cerr << "ERROR: output file parameter is missing" << std::endl;
 		return -1;
@@ -482,6 +506,8 @@ int extractWays(const char * inputFileName, const char * outputFileName, bool ve
 
 	osmpbf::BlobFileIn inFile(inputFileName);
 	osmpbf::BlobFileOut outFile(outputFileName);
+	if (!configureOutput(outFile, output))
+		return -1;
 
 	osmpbf::BlobDataBuffer buffer;
 
@@ -566,17 +592,54 @@ int extractWays(const char * inputFileName, const char * outputFileName, bool ve
 	return 0;
 }
 
+int buildIndex(char * inputFileName, char * outputFileName, bool verbose) {
+	osmpbf::OSMFileIn inFile(inputFileName, verbose);
+
+	if (!inFile.open())
+		return -1;
+
+	if (!inFile.buildBlobIndex(true)) {
+		std::cerr << "ERROR: could not build blob index" << std::endl;
+		return -1;
+	}
+
+	std::string indexFileName = outputFileName ? outputFileName : osmpbf::BlobIndex::sidecarFileName(inputFileName);
+	if (!inFile.saveBlobIndex(indexFileName))
+		return -1;
+
+	std::cout << "indexed " << inFile.blobCount() << " blobs into " << indexFileName << std::endl;
+
+	inFile.close();
+	return 0;
+}
+
 /* parameters:
  * -o file_name ... out file
  * -c file_name ... file to compare with
  * -m match_string ... work only on primitives matching
+ * -z codec ... compression of written blobs: none, zlib (default), lzma, lz4, zstd
+ * -l level ... compression level of written blobs
+ * -j threads ... compress written blobs on this many threads
  * -v ... verbose output
  */
+bool parseCompression(const char * name, osmpbf::BlobCompression & compression) {
+	const char * names[] = {"none", "zlib", "lzma", "lz4", "zstd"};
+	for (int i = 0; i < 5; ++i) {
+		if (!strcmp(name, names[i])) {
+			compression = (osmpbf::BlobCompression) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
 struct MyParameters {
 	char * inputFileName;
 	char * outputFileName;
 	char * compareFileName;
 	char * matchString;
+	OutputOptions output;
 	bool verbose;
 
 	MyParameters(int argc, char * argv[]) :
@@ -617,6 +680,32 @@ struct MyParameters {
 
 					matchString = argv[p];
 					break;
+				case 'z':
+					p++;
+					if ((p >= argc - 1) || !parseCompression(argv[p], output.compression)) {
+						std::cerr << "ERROR: invalid compression parameter" << std::endl;
+						return;
+					}
+
+					break;
+				case 'l':
+					p++;
+					if (p >= argc - 1) {
+						std::cerr << "ERROR: invalid compression level parameter" << std::endl;
+						return;
+					}
+
+					output.level = atoi(argv[p]);
+					break;
+				case 'j':
+					p++;
+					if ((p >= argc - 1) || (argv[p][0] == '-')) {
+						std::cerr << "ERROR: invalid thread count parameter" << std::endl;
+						return;
+					}
+
+					output.threads = (uint32_t) atoi(argv[p]);
+					break;
 				case 'v':
 					verbose = true;
 					break;
@@ -641,6 +730,7 @@ struct MyParameters {
 #define MODE_BLOB_STATS 's'
 #define MODE_BLOB_DATA_STATS 'S'
 #define MODE_EXTRACT_WAYS 'w'
+#define MODE_BUILD_INDEX 'i'
 
 int main(int argc, char * argv[]) {
 	if (argc < 3) {
@@ -657,7 +747,7 @@ int main(int argc, char * argv[]) {
 
 	switch (argv[1][0]) {
 	case MODE_COPY_BLOBS:
-		return copyBlobs(params.inputFileName, params.outputFileName, params.verbose);
+		return copyBlobs(params.inputFileName, params.outputFileName, params.output, params.verbose);
 	case MODE_COMPARE:
 		return compare(params.inputFileName, params.compareFileName, params.verbose);
 	case MODE_BLOB_STATS:
@@ -667,9 +757,11 @@ int main(int argc, char * argv[]) {
 	case MODE_DUMP_MATCH:
 		return dumpMatch(params.inputFileName, params.matchString, params.verbose);
 	case MODE_EXTRACT:
-		return extract(params.inputFileName, params.outputFileName, params.matchString, params.verbose);
+		return extract(params.inputFileName, params.outputFileName, params.matchString, params.output, params.verbose);
 	case MODE_EXTRACT_WAYS:
-		return extractWays(params.inputFileName, params.outputFileName, params.verbose);
+		return extractWays(params.inputFileName, params.outputFileName, params.output, params.verbose);
+	case MODE_BUILD_INDEX:
+		return buildIndex(params.inputFileName, params.outputFileName, params.verbose);
 	default:
 		std::cerr << "ERROR: unknown mode \"" << argv[1][0] << '\"' << std::endl;
 		return -1;
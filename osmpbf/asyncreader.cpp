@@ -0,0 +1,402 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#include "asyncreader.h"
+
+#include <osmpbf/fileio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#if defined(OSMPBF_WITH_IO_URING)
+	#include <linux/io_uring.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+namespace osmpbf
+{
+
+#if defined(OSMPBF_WITH_IO_URING)
+
+/// minimal io_uring instance driven by the raw system calls, liburing is not required
+class AsyncReader::IoUring
+{
+public:
+	IoUring() :
+		m_RingFd(-1),
+		m_SqRing(MAP_FAILED), m_SqRingSize(0),
+		m_CqRing(MAP_FAILED), m_CqRingSize(0),
+		m_Sqes(MAP_FAILED), m_SqesSize(0)
+	{}
+
+	~IoUring()
+	{
+		if (m_Sqes != MAP_FAILED)
+			::munmap(m_Sqes, m_SqesSize);
+		if (m_CqRing != MAP_FAILED && m_CqRing != m_SqRing)
+			::munmap(m_CqRing, m_CqRingSize);
+		if (m_SqRing != MAP_FAILED)
+			::munmap(m_SqRing, m_SqRingSize);
+		if (m_RingFd > -1)
+			::close(m_RingFd);
+	}
+
+	///@return false if io_uring is not available (old kernel, seccomp, ...)
+	bool init(uint32_t entries)
+	{
+		io_uring_params params;
+		::memset(&params, 0, sizeof(io_uring_params));
+
+		m_RingFd = (int) ::syscall(__NR_io_uring_setup, entries, &params);
+		if (m_RingFd < 0)
+			return false;
+
+		m_SqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+		m_CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+		bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (singleMmap)
+			m_SqRingSize = m_CqRingSize = std::max(m_SqRingSize, m_CqRingSize);
+
+		m_SqRing = ::mmap(0, m_SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQ_RING);
+		if (m_SqRing == MAP_FAILED)
+			return false;
+
+		m_CqRing = singleMmap ? m_SqRing :
+			::mmap(0, m_CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_CQ_RING);
+		if (m_CqRing == MAP_FAILED)
+			return false;
+
+		m_SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		m_Sqes = ::mmap(0, m_SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_RingFd, IORING_OFF_SQES);
+		if (m_Sqes == MAP_FAILED)
+			return false;
+
+		char * sq = static_cast<char *>(m_SqRing);
+		m_SqTail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+		m_SqMask = reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+		m_SqArray = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+
+		char * cq = static_cast<char *>(m_CqRing);
+		m_CqHead = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+		m_CqTail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+		m_CqMask = reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+		m_Cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+		return true;
+	}
+
+	///queue and submit a single read, the caller never has more reads in flight than entries
+	bool read(int fd, char * buffer, uint32_t length, uint64_t offset, uint64_t tag)
+	{
+		uint32_t tail = *m_SqTail;
+		uint32_t index = tail & *m_SqMask;
+
+		io_uring_sqe * sqe = static_cast<io_uring_sqe *>(m_Sqes) + index;
+		::memset(sqe, 0, sizeof(io_uring_sqe));
+		sqe->opcode = IORING_OP_READ;
+		sqe->fd = fd;
+		sqe->addr = reinterpret_cast<uint64_t>(buffer);
+		sqe->len = length;
+		sqe->off = offset;
+		sqe->user_data = tag;
+
+		m_SqArray[index] = index;
+		__atomic_store_n(m_SqTail, tail + 1, __ATOMIC_RELEASE);
+
+		int ret;
+		do {
+			ret = (int) ::syscall(__NR_io_uring_enter, m_RingFd, 1, 0, 0, NULL, 0);
+		} while (ret < 0 && errno == EINTR);
+
+		// not consumed by the kernel, take it back
+		if (ret != 1)
+			__atomic_store_n(m_SqTail, tail, __ATOMIC_RELEASE);
+
+		return ret == 1;
+	}
+
+	///wait for the next completion
+	bool complete(uint64_t & tag, int32_t & result)
+	{
+		for (;;)
+		{
+			uint32_t head = *m_CqHead;
+			if (head != __atomic_load_n(m_CqTail, __ATOMIC_ACQUIRE))
+			{
+				io_uring_cqe & cqe = m_Cqes[head & *m_CqMask];
+				tag = cqe.user_data;
+				result = cqe.res;
+				__atomic_store_n(m_CqHead, head + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+
+			// EAGAIN and EBUSY report a temporary shortage of completion entries or memory
+			int ret = (int) ::syscall(__NR_io_uring_enter, m_RingFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+			if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return false;
+		}
+	}
+
+private:
+	int m_RingFd;
+
+	void * m_SqRing;
+	std::size_t m_SqRingSize;
+	void * m_CqRing;
+	std::size_t m_CqRingSize;
+	void * m_Sqes;
+	std::size_t m_SqesSize;
+
+	uint32_t * m_SqTail;
+	uint32_t * m_SqMask;
+	uint32_t * m_SqArray;
+
+	uint32_t * m_CqHead;
+	uint32_t * m_CqTail;
+	uint32_t * m_CqMask;
+	io_uring_cqe * m_Cqes;
+};
+
+#else
+
+class AsyncReader::IoUring
+{
+public:
+	bool init(uint32_t) { return false; }
+	bool read(int, char *, uint32_t, uint64_t, uint64_t) { return false; }
+	bool complete(uint64_t &, int32_t &) { return false; }
+};
+
+#endif
+
+AsyncReader::AsyncReader(int fileDescriptor, uint64_t fileSize, uint32_t chunkSize, uint32_t queueDepth) :
+	m_FileDescriptor(fileDescriptor),
+	m_FileSize(fileSize),
+	m_ChunkSize(chunkSize),
+	m_Chunks(std::max<uint32_t>(queueDepth, 1)),
+	m_Head(0),
+	m_HeadDelivered(false),
+	m_InFlight(0),
+	m_NextOffset(0),
+	m_Ring(new IoUring()),
+	m_UseRing(false)
+{
+	for (Chunk & chunk : m_Chunks)
+	{
+		chunk.data = new char[m_ChunkSize];
+		chunk.offset = 0;
+		chunk.length = 0;
+		chunk.result = 0;
+		chunk.state = CHUNK_Idle;
+	}
+
+	// a single chunk gains nothing from asynchronous reads
+	m_UseRing = m_Chunks.size() > 1 && m_Ring->init((uint32_t) m_Chunks.size());
+}
+
+AsyncReader::~AsyncReader()
+{
+	drain();
+	delete m_Ring;
+
+	for (Chunk & chunk : m_Chunks)
+		delete[] chunk.data;
+}
+
+bool AsyncReader::usingIoUring() const
+{
+	return m_UseRing;
+}
+
+uint64_t AsyncReader::readAheadSize() const
+{
+	uint64_t size = 0;
+	for (uint32_t i = m_HeadDelivered ? 1 : 0; i < m_Chunks.size(); ++i)
+	{
+		const Chunk & chunk = m_Chunks[(m_Head + i) % m_Chunks.size()];
+		if (chunk.state != CHUNK_Idle)
+			size += chunk.length;
+	}
+
+	return size;
+}
+
+void AsyncReader::restart(uint64_t offset)
+{
+	drain();
+
+	for (Chunk & chunk : m_Chunks)
+		chunk.state = CHUNK_Idle;
+
+	m_Head = 0;
+	m_HeadDelivered = false;
+	m_NextOffset = offset;
+
+	for (Chunk & chunk : m_Chunks)
+		submit(chunk);
+}
+
+void AsyncReader::submit(Chunk & chunk)
+{
+	if (m_NextOffset >= m_FileSize)
+	{
+		chunk.state = CHUNK_Idle;
+		return;
+	}
+
+	chunk.offset = m_NextOffset;
+	chunk.length = (uint32_t) std::min<uint64_t>(m_ChunkSize, m_FileSize - m_NextOffset);
+	chunk.result = 0;
+	m_NextOffset += chunk.length;
+
+	if (m_UseRing && m_Ring->read(m_FileDescriptor, chunk.data, chunk.length, chunk.offset, &chunk - m_Chunks.data()))
+	{
+		chunk.state = CHUNK_Pending;
+		++m_InFlight;
+	}
+	else
+	{
+		// read synchronously once the chunk is requested
+		chunk.state = CHUNK_Queued;
+	}
+}
+
+bool AsyncReader::wait(Chunk & chunk)
+{
+	while (chunk.state == CHUNK_Pending)
+	{
+		if (!complete())
+			abandonRing();
+	}
+
+	uint32_t done = 0;
+	if (chunk.state == CHUNK_Done)
+	{
+		if (chunk.result >= int32_t(chunk.length))
+			return true;
+
+		// the kernel does not support the read request, stop using the ring
+		if (chunk.result < 0)
+			m_UseRing = false;
+		else
+			done = uint32_t(chunk.result);
+	}
+
+	// queued, failed or short reads are completed synchronously
+	if (!readSync(chunk, done))
+	{
+		chunk.state = CHUNK_Idle;
+		return false;
+	}
+
+	chunk.state = CHUNK_Done;
+	return true;
+}
+
+bool AsyncReader::complete()
+{
+	uint64_t tag;
+	int32_t result;
+	if (!m_Ring->complete(tag, result))
+		return false;
+
+	m_Chunks[tag].result = result;
+	m_Chunks[tag].state = CHUNK_Done;
+	--m_InFlight;
+
+	return true;
+}
+
+bool AsyncReader::readSync(Chunk & chunk, uint32_t done)
+{
+	while (done < chunk.length)
+	{
+		SignedSizeType count = osmpbf::pread(m_FileDescriptor, chunk.data + done, chunk.length - done, chunk.offset + done);
+		if (count <= 0)
+		{
+			std::cerr << "ERROR: could not read at offset " << chunk.offset + done << std::endl;
+			return false;
+		}
+
+		done += uint32_t(count);
+	}
+
+	chunk.result = int32_t(done);
+	return true;
+}
+
+void AsyncReader::drain()
+{
+	while (m_InFlight)
+	{
+		if (!complete())
+			abandonRing();
+	}
+}
+
+void AsyncReader::abandonRing()
+{
+	std::cerr << "ERROR: io_uring - waiting for completion failed, continuing with pread()" << std::endl;
+
+	// closing the ring cancels the reads in flight, but there is no way left to wait for it
+	delete m_Ring;
+	m_Ring = NULL;
+	m_UseRing = false;
+
+	// the kernel may still write into the buffers of cancelled reads, leave them behind
+	for (Chunk & chunk : m_Chunks)
+	{
+		if (chunk.state != CHUNK_Pending)
+			continue;
+
+		chunk.data = new char[m_ChunkSize];
+		chunk.state = CHUNK_Queued;
+	}
+
+	m_InFlight = 0;
+}
+
+bool AsyncReader::next(const char * & data, uint32_t & length)
+{
+	// the chunk handed out last is free again, reuse it for the next read-ahead
+	if (m_HeadDelivered)
+	{
+		submit(m_Chunks[m_Head]);
+		m_Head = (m_Head + 1) % m_Chunks.size();
+		m_HeadDelivered = false;
+	}
+
+	Chunk & chunk = m_Chunks[m_Head];
+	if (chunk.state == CHUNK_Idle || !wait(chunk))
+		return false;
+
+	data = chunk.data;
+	length = chunk.length;
+	m_HeadDelivered = true;
+
+	return true;
+}
+
+} // namespace osmpbf
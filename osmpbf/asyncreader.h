@@ -0,0 +1,101 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_ASYNCREADER_H
+#define OSMPBF_ASYNCREADER_H
+
+#include <cstdint>
+#include <vector>
+
+// internal header, not installed
+
+namespace osmpbf
+{
+
+/**
+ * Sequential read-ahead over a regular file in fixed size chunks.
+ * Up to @queueDepth chunks are in flight through io_uring if the kernel allows it,
+ * otherwise every chunk is read synchronously with pread().
+ * Not thread-safe, the owner serializes access.
+ */
+class AsyncReader
+{
+public:
+	AsyncReader(int fileDescriptor, uint64_t fileSize, uint32_t chunkSize, uint32_t queueDepth);
+	~AsyncReader();
+
+	///drop all chunks and continue reading at @offset
+	void restart(uint64_t offset);
+
+	/**
+	 * hand out the next chunk in file order, blocks until it was read
+	 * @data stays valid until the next call to next() or restart()
+	 *
+	 * @return false at the end of the file or on read errors
+	 */
+	bool next(const char * & data, uint32_t & length);
+
+	///@return true if reads are issued through io_uring
+	bool usingIoUring() const;
+
+	///number of bytes read ahead beyond the chunk handed out last
+	uint64_t readAheadSize() const;
+
+private:
+	enum ChunkState { CHUNK_Idle, CHUNK_Queued, CHUNK_Pending, CHUNK_Done };
+
+	struct Chunk
+	{
+		char * data;
+		uint64_t offset;
+		uint32_t length;
+		int32_t result;
+		ChunkState state;
+	};
+
+	class IoUring;
+
+	int m_FileDescriptor;
+	uint64_t m_FileSize;
+	uint32_t m_ChunkSize;
+
+	std::vector<Chunk> m_Chunks;
+	uint32_t m_Head;
+	bool m_HeadDelivered;
+	uint32_t m_InFlight;
+	uint64_t m_NextOffset;
+
+	IoUring * m_Ring;
+	bool m_UseRing;
+
+	void submit(Chunk & chunk);
+	bool wait(Chunk & chunk);
+	///reap a single completion
+	bool complete();
+	///wait for all reads in flight, their buffers must not be reused before
+	void drain();
+	///stop using a failed ring, the reads still in flight are read again with pread()
+	void abandonRing();
+	bool readSync(Chunk & chunk, uint32_t done);
+};
+
+} // namespace osmpbf
+
+#endif // OSMPBF_ASYNCREADER_H
@@ -0,0 +1,145 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#include <osmpbf/blobbufferpool.h>
+
+#include <algorithm>
+
+namespace osmpbf
+{
+
+namespace
+{
+
+///smaller buffers are not worth pooling
+constexpr int MIN_SIZE_CLASS = 12;
+
+///largest class whose buffers are at least @capacity bytes large
+inline int floorClass(uint32_t capacity)
+{
+	int result = 0;
+	while (capacity >>= 1)
+		++result;
+
+	return result;
+}
+
+///smallest class whose buffers can hold @size bytes
+inline int ceilClass(uint32_t size)
+{
+	int result = floorClass(size);
+	return (uint32_t(1) << result) < size ? result + 1 : result;
+}
+
+} // anonymous namespace
+
+BlobBufferPool::BlobBufferPool(uint32_t maxBuffersPerClass, uint64_t maxBytes) :
+	m_MaxBuffersPerClass(maxBuffersPerClass),
+	m_MaxBytes(maxBytes),
+	m_IdleBytes(0)
+{}
+
+BlobBufferPool::~BlobBufferPool()
+{
+	clear();
+}
+
+void BlobBufferPool::reserve(char * & data, uint32_t & capacity, uint32_t size)
+{
+	if (data && capacity >= size)
+		return;
+
+	release(data, capacity);
+
+	int sizeClass = std::max(ceilClass(size), MIN_SIZE_CLASS);
+
+	// take a buffer of the matching or the next larger class, larger ones would waste too much memory
+	for (int i = sizeClass; i < SIZE_CLASS_COUNT && i <= sizeClass + 1; ++i)
+	{
+		SizeClass & c = m_Classes[i];
+		std::lock_guard<std::mutex> lck(c.lock);
+
+		if (c.buffers.empty())
+			continue;
+
+		data = c.buffers.back().data;
+		capacity = c.buffers.back().capacity;
+		c.buffers.pop_back();
+
+		m_IdleBytes -= capacity;
+		return;
+	}
+
+	// round up so the buffer serves every request of its class once it is released
+	capacity = sizeClass < SIZE_CLASS_COUNT - 1 ? uint32_t(1) << sizeClass : size;
+	data = new char[capacity];
+}
+
+void BlobBufferPool::release(char * & data, uint32_t & capacity)
+{
+	if (!data)
+		return;
+
+	int sizeClass = floorClass(capacity);
+
+	if (capacity && sizeClass >= MIN_SIZE_CLASS)
+	{
+		SizeClass & c = m_Classes[sizeClass];
+		std::lock_guard<std::mutex> lck(c.lock);
+
+		if (c.buffers.size() < m_MaxBuffersPerClass && m_IdleBytes + capacity <= m_MaxBytes)
+		{
+			c.buffers.push_back(Buffer{data, capacity});
+			m_IdleBytes += capacity;
+
+			data = NULL;
+			capacity = 0;
+			return;
+		}
+	}
+
+	delete[] data;
+	data = NULL;
+	capacity = 0;
+}
+
+void BlobBufferPool::clear()
+{
+	for (SizeClass & c : m_Classes)
+	{
+		std::lock_guard<std::mutex> lck(c.lock);
+
+		for (Buffer & buffer : c.buffers)
+		{
+			m_IdleBytes -= buffer.capacity;
+			delete[] buffer.data;
+		}
+
+		c.buffers.clear();
+	}
+}
+
+BlobBufferPool & BlobBufferPool::global()
+{
+	static BlobBufferPool pool;
+	return pool;
+}
+
+} // namespace osmpbf
@@ -19,107 +19,429 @@
  */
 
 #include <osmpbf/blobfile.h>
+#include <osmpbf/blobbufferpool.h>
 #include <osmpbf/fileio.h>
 #include <osmpbf/net.h>
 
 #include "osmblob.pb.h"
+#include "compression.h"
+#include "asyncreader.h"
+#include "wireformat.h"
 
+#include <cstring>
 #include <iostream>
 #include <limits>
-#include <zlib.h>
-#include <assert.h>
 #include <memory>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
 
 namespace osmpbf
 {
 
-bool inflateData(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+namespace
 {
-	int ret;
-	z_stream stream;
 
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = Z_NULL;
-	stream.avail_in = sourceSize;
-	stream.next_in = (Bytef *)source;
-	stream.avail_out = destSize;
-	stream.next_out = (Bytef *)dest;
+constexpr uint32_t MAX_HEADER_SIZE = 64 << 10;
+constexpr uint32_t MAX_BODY_SIZE = 32 << 20;
+///consumed file data is released in steps of at least this size
+constexpr SizeType RELEASE_GRANULARITY = 16 << 20;
 
-	ret = inflateInit(&stream);
-	if (ret != Z_OK)
-		return false;
+inline BlobCompression compressionForField(uint64_t field)
+{
+	switch (field)
+	{
+	case 3: return COMPRESSION_Zlib;
+	case 4: return COMPRESSION_Lzma;
+	case 6: return COMPRESSION_Lz4;
+	case 7: return COMPRESSION_Zstd;
+	default: return COMPRESSION_None;
+	}
+}
+
+inline uint32_t fieldForCompression(BlobCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_Zlib: return 3;
+	case COMPRESSION_Lzma: return 4;
+	case COMPRESSION_Lz4: return 6;
+	case COMPRESSION_Zstd: return 7;
+	default: return 1;
+	}
+}
+
+inline uint32_t varintSize(uint64_t value)
+{
+	uint32_t size = 1;
+	for (; value >= 0x80; value >>= 7)
+		++size;
+
+	return size;
+}
 
-	ret = inflate(&stream, Z_FINISH);
+inline void appendVarint(std::string & out, uint64_t value)
+{
+	for (; value >= 0x80; value >>= 7)
+		out.push_back(char(value | 0x80));
 
-	assert(ret != Z_STREAM_ERROR);
+	out.push_back(char(value));
+}
 
-	switch (ret)
+///primitive type of a PrimitiveGroup by the field number of its first field
+inline PrimitiveType groupPrimitiveType(uint64_t field)
+{
+	switch (field)
 	{
-	case Z_NEED_DICT:
-		std::cerr << "ERROR: zlib - Z_NEED_DICT" << std::endl;
-		inflateEnd(&stream);
-		return false;
-	case Z_DATA_ERROR:
-		std::cerr << "ERROR: zlib - Z_DATA_ERROR" << std::endl;
-		inflateEnd(&stream);
+	case 1: // nodes
+	case 2: // dense
+		return NodePrimitive;
+	case 3: return WayPrimitive;
+	case 4: return RelationPrimitive;
+	default: return NoPrimitive;
+	}
+}
+
+/**
+ * collect the primitive types of the groups in the serialized PrimitiveBlock @data
+ * only the first field of each group is read, group contents are skipped by their length
+ *
+ * @param firstOnly stop at the first primitive group
+ * @param required prefix length needed to continue if @data is a truncated block
+ * @return false if @data ended before the scan was complete
+ */
+bool scanPrimitiveGroups(const char * data, uint32_t length, bool firstOnly, PrimitiveTypeFlags & types, uint32_t & required)
+{
+	const uint8_t * begin = reinterpret_cast<const uint8_t *>(data);
+	const uint8_t * pos = begin;
+	const uint8_t * end = pos + length;
+
+	types = NoPrimitive;
+	required = length + 16;
+
+	while (pos < end)
+	{
+		uint64_t key, value;
+		if (!readVarint(pos, end, key))
+			return false;
+
+		switch (key & 0x7)
+		{
+		case WIRE_LengthDelimited:
+			if (!readVarint(pos, end, value))
+				return false;
+
+			if ((key >> 3) == 2 && value)
+			{
+				const uint8_t * groupPos = pos;
+				uint64_t groupKey;
+				if (!readVarint(groupPos, value < uint64_t(end - pos) ? pos + value : end, groupKey))
+				{
+					required = uint32_t(pos - begin) + 16;
+					return false;
+				}
+
+				types |= groupPrimitiveType(groupKey >> 3);
+				if (firstOnly && types)
+					return true;
+			}
+
+			if (value > uint64_t(end - pos))
+			{
+				required = uint32_t(std::min<uint64_t>(uint64_t(pos - begin) + value + 16, MAX_BODY_SIZE));
+				return false;
+			}
+
+			pos += value;
+			break;
+		case WIRE_Varint:
+		case WIRE_Fixed64:
+		case WIRE_Fixed32:
+			// only fails on truncated data here
+			if (!skipField(key, pos, end))
+				return false;
+			break;
+		default:
+			// corrupt data, leave it to the parser
+			types = NoPrimitive;
+			return true;
+		}
+	}
+
+	return pos == end;
+}
+
+/**
+ * quietly check for a blob length field and a BlobHeader of a known type at the start of @data
+ *
+ * @param available bytes available at @data
+ * @param blobSize size of length field, header and blob if found
+ */
+bool probeBlobHeader(const char * data, uint64_t available, uint64_t & blobSize)
+{
+	const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+
+	// length field below MAX_HEADER_SIZE followed by the type field
+	if (available < 5 || bytes[0] || bytes[1] || bytes[4] != 0x0A)
 		return false;
-	case Z_MEM_ERROR:
-		std::cerr << "ERROR: zlib - Z_MEM_ERROR" << std::endl;
-		inflateEnd(&stream);
+
+	uint32_t headerLength = (uint32_t(bytes[2]) << 8) | bytes[3];
+	if (4 + uint64_t(headerLength) > available)
 		return false;
-	default:
-		break;
+
+	const uint8_t * pos = bytes + 4;
+	const uint8_t * end = pos + headerLength;
+
+	bool knownType = false;
+	uint64_t dataSize = 0;
+	while (pos < end)
+	{
+		uint64_t key;
+		if (!readVarint(pos, end, key))
+			return false;
+
+		uint64_t field = key >> 3;
+		if ((key & 0x7) == WIRE_Varint && field == 3)
+		{
+			if (!readVarint(pos, end, dataSize))
+				return false;
+		}
+		else if ((key & 0x7) == WIRE_LengthDelimited && field == 1)
+		{
+			const uint8_t * type;
+			uint64_t typeLength;
+			if (!readLengthDelimited(pos, end, type, typeLength))
+				return false;
+
+			knownType = (typeLength == 7 && !::memcmp(type, "OSMData", 7)) || (typeLength == 9 && !::memcmp(type, "OSMHeader", 9));
+		}
+		else if (!skipField(key, pos, end))
+		{
+			return false;
+		}
 	}
 
-	inflateEnd(&stream);
+	if (!knownType || !dataSize || dataSize >= MAX_BODY_SIZE)
+		return false;
+
+	blobSize = 4 + headerLength + dataSize;
 	return true;
 }
 
-uint32_t deflateData(const char * source, uint32_t sourceSize, char *& dest, uint32_t & destSize)
+/**
+ * parseBlobView() for the first @length bytes of a serialized Blob, its payload may be cut off
+ * raw_size precedes the payload, so the view is complete except for dataSize then
+ *
+ * @return false if the payload does not start within @data
+ */
+bool parseBlobViewPrefix(const char * data, uint32_t length, BlobView & view)
+{
+	const uint8_t * pos = reinterpret_cast<const uint8_t *>(data);
+	const uint8_t * end = pos + length;
+
+	view = BlobView();
+
+	while (pos < end)
+	{
+		uint64_t key, value;
+		if (!readVarint(pos, end, key))
+			return false;
+
+		uint64_t field = key >> 3;
+		if ((key & 0x7) == WIRE_Varint && field == 2)
+		{
+			if (!readVarint(pos, end, value) || value >= MAX_BODY_SIZE)
+				return false;
+
+			view.rawSize = uint32_t(value);
+			view.hasRawSize = true;
+		}
+		else if ((key & 0x7) == WIRE_LengthDelimited && (field == 1 || compressionForField(field) != COMPRESSION_None))
+		{
+			if (!readVarint(pos, end, value))
+				return false;
+
+			view.data = reinterpret_cast<const char *>(pos);
+			view.dataSize = uint32_t(std::min<uint64_t>(value, uint64_t(end - pos)));
+			view.compression = compressionForField(field);
+
+			if (view.isRaw())
+				view.rawSize = view.dataSize;
+
+			return true;
+		}
+		else if (!skipField(key, pos, end))
+		{
+			return false;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * type of the first primitive group in the payload of @view, only its start is decompressed
+ *
+ * @param truncated the payload of @view is cut off
+ * @param type NoPrimitive if unknown
+ * @return false if the truncated payload ended before the first group
+ */
+bool peekViewPrimitiveType(const BlobView & view, bool truncated, PrimitiveType & type)
+{
+	type = NoPrimitive;
+
+	if (!view.data || view.rawSize >= MAX_BODY_SIZE || !prefixDecompressionSupported(view.compression))
+		return true;
+
+	thread_local std::vector<char> prefix;
+
+	// the string table comes first, grow the prefix until the first group is reached
+	uint32_t prefixSize = std::min<uint32_t>(view.rawSize, 4096);
+	for (;;)
+	{
+		const char * data = view.data;
+		uint32_t length = view.dataSize;
+
+		if (!view.isRaw())
+		{
+			prefix.resize(prefixSize);
+			length = decompressPrefix(view.compression, view.data, view.dataSize, prefix.data(), prefixSize);
+			data = prefix.data();
+
+			if (!length)
+				return !truncated;
+		}
+
+		PrimitiveTypeFlags types;
+		uint32_t required;
+		if (scanPrimitiveGroups(data, length, true, types, required))
+		{
+			type = PrimitiveType(types);
+			return true;
+		}
+
+		// the payload ran out before the decompressed prefix did
+		if (view.isRaw() || length < prefixSize)
+			return !truncated;
+
+		if (prefixSize >= view.rawSize)
+			return true;
+
+		prefixSize = std::min(view.rawSize, std::max(required, 2 * prefixSize));
+	}
+}
+
+/// decompress or copy the payload of @view into @buffer, growing it if neccessary
+bool decodeViewPayload(const BlobView & view, char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize, bool verbose)
 {
-	int ret;
-	z_stream stream;
+	if (!view.data)
+	{
+		std::cerr << "ERROR: unsupported blob compression" << std::endl;
+		return false;
+	}
+
+	if (verbose)
+	{
+		if (view.isRaw())
+			std::cout << "found uncompressed blob data" << std::endl;
+		else
+			std::cout << "found " << compressionName(view.compression) << " compressed blob data" << std::endl
+				<< "uncompressed size : " << view.rawSize << "B ( " << view.rawSize / 1024.f << " KiB )" << std::endl;
+	}
+
+	if (!view.isRaw() && !view.hasRawSize)
+	{
+		std::cerr << "ERROR: compressed blob without raw size" << std::endl;
+		return false;
+	}
+
+	if (!view.isRaw() && view.rawSize >= MAX_BODY_SIZE)
+	{
+		std::cerr << "ERROR: invalid uncompressed blob size: " << view.rawSize << std::endl;
+		return false;
+	}
+
+	availableDataSize = view.rawSize;
+	BlobBufferPool::global().reserve(buffer, bufferSize, availableDataSize);
+
+	if (view.isRaw())
+	{
+		memmove(buffer, view.data, availableDataSize);
+		return true;
+	}
 
-	stream.zalloc = Z_NULL;
-	stream.zfree = Z_NULL;
-	stream.opaque = Z_NULL;
+	if (verbose) std::cout << "decompressing data ... ";
 
-	ret = deflateInit(&stream, Z_BEST_COMPRESSION);
-	assert(ret != Z_STREAM_ERROR);
+	if (!decompressData(view.compression, view.data, view.dataSize, buffer, availableDataSize))
+		return false;
 
-	//overvlow will result in error during stream decoding
-	destSize = (uint32_t) deflateBound(&stream, sourceSize);
-	dest = new char[destSize];
+	if (verbose) std::cout << "done" << std::endl;
+	return true;
+}
 
-	stream.avail_in = sourceSize;
-	stream.next_in = (Bytef *)source;
-	stream.avail_out = destSize;
-	stream.next_out = (Bytef *)dest;
+} // anonymous namespace
 
-	ret = deflate(&stream, Z_FINISH);
+bool parseBlobView(const char * data, uint32_t length, BlobView & view)
+{
+	const uint8_t * pos = reinterpret_cast<const uint8_t *>(data);
+	const uint8_t * end = pos + length;
 
-	assert(ret != Z_STREAM_ERROR);
+	view.compression = COMPRESSION_None;
+	view.data = NULL;
+	view.dataSize = 0;
+	view.rawSize = 0;
+	view.hasRawSize = false;
 
-	deflateEnd(&stream);
-	switch (ret)
+	while (pos < end)
 	{
-	case Z_NEED_DICT:
-		std::cerr << "ERROR: zlib - Z_NEED_DICT" << std::endl;
-		return 0;
-	case Z_DATA_ERROR:
-		std::cerr << "ERROR: zlib - Z_DATA_ERROR" << std::endl;
-		return 0;
-	case Z_MEM_ERROR:
-		std::cerr << "ERROR: zlib - Z_MEM_ERROR" << std::endl;
-		return 0;
-	case Z_STREAM_END:
-		//has to smaller than destSize (which is uint32_t)
-		return (uint32_t) stream.total_out;
-	default:
-		std::cerr << "ERROR: zlib - input not compressable" << std::endl;
-		return 0;
+		uint64_t key;
+		if (!readVarint(pos, end, key))
+			return false;
+
+		uint64_t field = key >> 3;
+		if ((key & 0x7) == WIRE_Varint && field == 2)
+		{
+			uint64_t rawSize;
+			if (!readVarint(pos, end, rawSize) || rawSize >= MAX_BODY_SIZE)
+				return false;
+
+			view.rawSize = uint32_t(rawSize);
+			view.hasRawSize = true;
+		}
+		else if ((key & 0x7) == WIRE_LengthDelimited && (field == 1 || compressionForField(field) != COMPRESSION_None))
+		{
+			const uint8_t * payload;
+			uint64_t payloadSize;
+			if (!readLengthDelimited(pos, end, payload, payloadSize))
+				return false;
+
+			view.data = reinterpret_cast<const char *>(payload);
+			view.dataSize = uint32_t(payloadSize);
+			view.compression = compressionForField(field);
+		}
+		else if (!skipField(key, pos, end))
+		{
+			return false;
+		}
 	}
+
+	if (view.isRaw())
+		view.rawSize = view.dataSize;
+
+	return true;
+}
+
+bool decodeBlobView(const BlobView & view, BlobDataBuffer & buffer)
+{
+	buffer.type = BLOB_Invalid;
+
+	if (view.type == BLOB_Invalid || !decodeViewPayload(view, buffer.data, buffer.totalBytes, buffer.availableBytes, false))
+		return false;
+
+	buffer.type = view.type;
+	return true;
 }
 
 AbstractBlobFile::AbstractBlobFile(const std::string & fileName)
@@ -130,8 +452,264 @@ AbstractBlobFile::AbstractBlobFile(const std::string & fileName)
 	GOOGLE_PROTOBUF_VERIFY_VERSION;
 }
 
+// BlobFileIn::Pipeline
+
+class BlobFileIn::Pipeline
+{
+public:
+	Pipeline(BlobFileIn & file, SizeType position, uint32_t threadCount, uint32_t queueDepth);
+	~Pipeline();
+
+	///thread-safe, hands out the next decoded blob in file order
+	BlobDataType pop(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize);
+
+	///end of the last blob handed out
+	inline SizeType position() const { return m_Position; }
+
+private:
+	enum SlotState { SLOT_Free, SLOT_Scanned, SLOT_Decoding, SLOT_Ready };
+
+	struct Slot
+	{
+		SlotState state = SLOT_Free;
+		BlobDataType type = BLOB_Invalid;
+		SizeType dataPosition = 0;
+		SizeType endPosition = 0;
+		uint32_t blobLength = 0;
+		///decoded block has none of the wanted primitive types
+		bool skip = false;
+
+		char * data = nullptr;
+		uint32_t totalBytes = 0;
+		uint32_t availableBytes = 0;
+	};
+
+	void readerFunc();
+	void decoderFunc();
+
+	BlobFileIn & m_File;
+
+	std::mutex m_Lock;
+	std::condition_variable m_SlotFreed;
+	std::condition_variable m_BlobScanned;
+	std::condition_variable m_BlobReady;
+
+	std::vector<Slot> m_Slots;
+	uint64_t m_ScanSeq;
+	uint64_t m_DecodeSeq;
+	uint64_t m_DeliverSeq;
+	bool m_ReaderDone;
+	bool m_Stop;
+
+	SizeType m_ReadPosition;
+	std::atomic<SizeType> m_Position;
+
+	std::vector<std::thread> m_Threads;
+};
+
+BlobFileIn::Pipeline::Pipeline(BlobFileIn & file, SizeType position, uint32_t threadCount, uint32_t queueDepth) :
+	m_File(file),
+	m_Slots(std::max<uint32_t>(queueDepth, 1)),
+	m_ScanSeq(0),
+	m_DecodeSeq(0),
+	m_DeliverSeq(0),
+	m_ReaderDone(false),
+	m_Stop(false),
+	m_ReadPosition(position),
+	m_Position(position)
+{
+	m_Threads.reserve(threadCount + 1);
+	m_Threads.emplace_back(&Pipeline::readerFunc, this);
+	for (uint32_t i = 0; i < threadCount; ++i)
+		m_Threads.emplace_back(&Pipeline::decoderFunc, this);
+}
+
+BlobFileIn::Pipeline::~Pipeline()
+{
+	{
+		std::lock_guard<std::mutex> lck(m_Lock);
+		m_Stop = true;
+	}
+
+	m_SlotFreed.notify_all();
+	m_BlobScanned.notify_all();
+	m_BlobReady.notify_all();
+
+	for (std::thread & t : m_Threads)
+		t.join();
+
+	for (Slot & slot : m_Slots)
+		BlobBufferPool::global().release(slot.data, slot.totalBytes);
+}
+
+void BlobFileIn::Pipeline::readerFunc()
+{
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lck(m_Lock);
+			m_SlotFreed.wait(lck, [this]() { return m_Stop || m_ScanSeq < m_DeliverSeq + m_Slots.size(); });
+
+			if (m_Stop)
+				break;
+		}
+
+		if (m_ReadPosition >= m_File.m_ReadLimit)
+			break;
+
+		uint32_t headerSize = 0;
+		uint32_t blobLength = 0;
+		BlobDataType blobDataType;
+
+		if (!m_File.readBlobHeader(m_ReadPosition, headerSize, blobLength, blobDataType))
+			break;
+
+		if (!blobDataType || !blobLength || blobLength >= MAX_BODY_SIZE || m_ReadPosition + 4 + headerSize + blobLength > m_File.size())
+		{
+			std::cerr << "ERROR: invalid blob found at position " << m_ReadPosition << std::endl;
+			break;
+		}
+
+		if (blobDataType == BLOB_OSMData && m_File.m_SortedByType && m_File.primitiveFilterActive())
+		{
+			std::unique_lock<std::mutex> fileLck(m_File.m_fileLock);
+			FilterAction action = m_File.sortedFilterAction(m_File.peekPrimitiveTypeCached(m_ReadPosition), m_ReadPosition + 4 + headerSize + blobLength);
+			fileLck.unlock();
+
+			if (action == FILTER_SkipRest)
+			{
+				m_ReadPosition = m_File.size();
+				break;
+			}
+
+			if (action == FILTER_Skip)
+			{
+				m_ReadPosition += 4 + headerSize + blobLength;
+				continue;
+			}
+		}
+
+		std::lock_guard<std::mutex> lck(m_Lock);
+		Slot & slot = m_Slots[m_ScanSeq % m_Slots.size()];
+		slot.type = blobDataType;
+		slot.dataPosition = m_ReadPosition + 4 + headerSize;
+		slot.blobLength = blobLength;
+		slot.endPosition = slot.dataPosition + blobLength;
+		slot.state = SLOT_Scanned;
+
+		m_ReadPosition = slot.endPosition;
+		++m_ScanSeq;
+		m_BlobScanned.notify_one();
+	}
+
+	std::lock_guard<std::mutex> lck(m_Lock);
+	m_ReaderDone = true;
+	m_BlobScanned.notify_all();
+	m_BlobReady.notify_all();
+}
+
+void BlobFileIn::Pipeline::decoderFunc()
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	for (;;)
+	{
+		m_BlobScanned.wait(lck, [this]() { return m_Stop || m_ReaderDone || m_DecodeSeq < m_ScanSeq; });
+
+		if (m_Stop || m_DecodeSeq == m_ScanSeq)
+			break;
+
+		Slot & slot = m_Slots[m_DecodeSeq % m_Slots.size()];
+		slot.state = SLOT_Decoding;
+		++m_DecodeSeq;
+
+		// the slot is owned by this thread until it is marked as ready
+		lck.unlock();
+		slot.type = m_File.decodeBlob(static_cast<const char *>(m_File.fileData(slot.dataPosition)), slot.blobLength, slot.type,
+			slot.data, slot.totalBytes, slot.availableBytes);
+		slot.skip = slot.type == BLOB_OSMData && !m_File.wantedPrimitiveBlock(slot.data, slot.availableBytes);
+		lck.lock();
+
+		slot.state = SLOT_Ready;
+		m_BlobReady.notify_all();
+	}
+}
+
+BlobDataType BlobFileIn::Pipeline::pop(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize)
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	for (;;)
+	{
+		m_BlobReady.wait(lck, [this]() {
+			return m_Stop ||
+				(m_ReaderDone && m_DeliverSeq == m_ScanSeq) ||
+				m_Slots[m_DeliverSeq % m_Slots.size()].state == SLOT_Ready;
+		});
+
+		Slot & slot = m_Slots[m_DeliverSeq % m_Slots.size()];
+		if (slot.state != SLOT_Ready || !slot.skip)
+			break;
+
+		m_Position = slot.endPosition;
+		slot.state = SLOT_Free;
+		slot.availableBytes = 0;
+		++m_DeliverSeq;
+		m_SlotFreed.notify_one();
+	}
+
+	Slot & slot = m_Slots[m_DeliverSeq % m_Slots.size()];
+	if (slot.state != SLOT_Ready)
+	{
+		// everything behind the last blob was filtered
+		if (m_ReaderDone && m_DeliverSeq == m_ScanSeq && m_ReadPosition >= m_File.m_ReadLimit)
+			m_Position = m_ReadPosition;
+
+		return BLOB_Invalid;
+	}
+
+	// hand out the decoded data and keep the caller's buffer for reuse
+	std::swap(buffer, slot.data);
+	std::swap(bufferSize, slot.totalBytes);
+	availableDataSize = slot.availableBytes;
+
+	BlobDataType result = slot.type;
+	SizeType position = slot.endPosition;
+	m_Position = position;
+
+	slot.state = SLOT_Free;
+	slot.availableBytes = 0;
+	++m_DeliverSeq;
+
+	lck.unlock();
+	m_SlotFreed.notify_one();
+
+	// all blobs in front of the delivered one are decoded
+	if (m_File.m_AccessPattern == ACCESS_Sequential)
+	{
+		std::lock_guard<std::mutex> fileLck(m_File.m_fileLock);
+		m_File.releaseConsumed(position);
+	}
+
+	return result;
+}
+
+// BlobFileIn
+
 BlobFileIn::BlobFileIn(const std::string & fileName)
-	: AbstractBlobFile(fileName), m_FileData(NULL)
+	: AbstractBlobFile(fileName),
+	  m_FileData(NULL),
+	  m_FilePos(0),
+	  m_FileSize(0),
+	  m_ReadLimit(0),
+	  m_Pipeline(NULL),
+	  m_PipelineThreads(0),
+	  m_PipelineDepth(0),
+	  m_AccessPattern(ACCESS_Default),
+	  m_HugePages(false),
+	  m_ReleasedPos(0),
+	  m_WantedPrimitives(AllPrimitives),
+	  m_SortedByType(false),
+	  m_PeekPosition((std::numeric_limits<uint64_t>::max)()),
+	  m_PeekType(NoPrimitive)
 {
 }
 
@@ -162,278 +740,1444 @@ bool BlobFileIn::open()
 		osmpbf::close(m_FileDescriptor);
 		m_FileDescriptor = -1;
 		return false;
-	}
-	
-	if (fileSize > (std::numeric_limits<SizeType>::max)())
+	}
+	
+	if (fileSize > (std::numeric_limits<SizeType>::max)())
+	{
+		std::cerr << "ERROR: input file is larger than " << ((std::numeric_limits<SizeType>::max)() >> 30) << " GiB" << std::endl;
+		osmpbf::close(m_FileDescriptor);
+		m_FileDescriptor = -1;
+		return false;
+	}
+
+	m_FileSize = fileSize;
+	m_ReadLimit = m_FileSize;
+
+	m_FileData = (char *) mmap(0, SizeType(m_FileSize), MM_PROT_READ, MM_MAP_SHARED, m_FileDescriptor, 0);
+
+	if (!osmpbf::validMmapAddress(m_FileData))
+	{
+		std::cerr << "ERROR: could not mmap file" << std::endl;
+		osmpbf::close(m_FileDescriptor);
+		m_FileDescriptor = -1;
+		m_FileData = NULL;
+		return false;
+	}
+
+	m_ReleasedPos = 0;
+	m_PeekPosition = (std::numeric_limits<uint64_t>::max)();
+	applyAccessPattern();
+
+	if (m_VerboseOutput) std::cout << "done" << std::endl;
+	return true;
+}
+
+void BlobFileIn::close()
+{
+	stopPipeline();
+
+	if (m_FileData)
+	{
+		if (m_VerboseOutput) std::cout << "closing file ...";
+		osmpbf::munmap(m_FileData, SizeType(m_FileSize));
+		osmpbf::close(m_FileDescriptor);
+		if (m_VerboseOutput) std::cout << "done" << std::endl;
+
+		m_FileData = NULL;
+		m_FileDescriptor = -1;
+	}
+}
+
+void BlobFileIn::seek(OffsetType position)
+{
+	stopPipeline();
+	m_FilePos = position;
+
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	resetReleasedPosition(m_FilePos);
+}
+
+SizeType BlobFileIn::position() const
+{
+	return m_Pipeline ? m_Pipeline->position() : m_FilePos;
+}
+
+SizeType BlobFileIn::size() const
+{
+	return SizeType(m_FileSize);
+}
+
+void BlobFileIn::readBlob(BlobDataBuffer & buffer)
+{
+	buffer.type = readBlob(buffer.data, buffer.totalBytes, buffer.availableBytes);
+}
+
+void BlobFileIn::setPipelineMode(uint32_t threadCount, uint32_t queueDepth)
+{
+	stopPipeline();
+
+	m_PipelineThreads = threadCount;
+	m_PipelineDepth = queueDepth ? queueDepth : 2 * threadCount;
+}
+
+void BlobFileIn::setAccessPattern(AccessPattern pattern, bool hugePages)
+{
+	std::lock_guard<std::mutex> lck(m_fileLock);
+
+	m_AccessPattern = pattern;
+	m_HugePages = hugePages;
+
+	if (m_FileDescriptor > -1)
+	{
+		resetReleasedPosition(position());
+		applyAccessPattern();
+	}
+}
+
+void BlobFileIn::applyAccessPattern()
+{
+	int advice = IO_ADVICE_NORMAL;
+	if (m_AccessPattern == ACCESS_Sequential)
+		advice = IO_ADVICE_SEQUENTIAL;
+	else if (m_AccessPattern == ACCESS_Random)
+		advice = IO_ADVICE_RANDOM;
+
+	// hints are best effort, failures only cost performance
+	if (m_FileData)
+	{
+		osmpbf::madvise(m_FileData, SizeType(m_FileSize), advice);
+		if (m_HugePages)
+			osmpbf::madvise(m_FileData, SizeType(m_FileSize), IO_ADVICE_HUGEPAGE);
+	}
+
+	osmpbf::fadvise(m_FileDescriptor, 0, 0, advice);
+}
+
+void BlobFileIn::releaseConsumed(uint64_t position)
+{
+	if (m_AccessPattern != ACCESS_Sequential || m_FileDescriptor < 0)
+		return;
+
+	uint64_t end = position & ~uint64_t(osmpbf::pageSize() - 1);
+	if (end <= m_ReleasedPos || end - m_ReleasedPos < RELEASE_GRANULARITY)
+		return;
+
+	// drop the pages from this process first, the page cache only releases unmapped pages
+	if (m_FileData)
+		osmpbf::madvise(fileData(m_ReleasedPos), SizeType(end - m_ReleasedPos), IO_ADVICE_DONTNEED);
+
+	osmpbf::fadvise(m_FileDescriptor, m_ReleasedPos, end - m_ReleasedPos, IO_ADVICE_DONTNEED);
+	m_ReleasedPos = end;
+}
+
+void BlobFileIn::resetReleasedPosition(uint64_t position)
+{
+	m_ReleasedPos = position & ~uint64_t(osmpbf::pageSize() - 1);
+}
+
+void BlobFileIn::setPrimitiveFilter(PrimitiveTypeFlags wanted, bool sortedByType)
+{
+	stopPipeline();
+
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	m_WantedPrimitives = wanted & AllPrimitives;
+	m_SortedByType = sortedByType;
+}
+
+PrimitiveType BlobFileIn::peekPrimitiveType(uint64_t position) const
+{
+	uint32_t headerSize = 0;
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
+
+	if (!readBlobHeader(position, headerSize, blobLength, blobDataType) || blobDataType != BLOB_OSMData ||
+		blobLength >= MAX_BODY_SIZE || position + 4 + headerSize + blobLength > m_FileSize)
+	{
+		return NoPrimitive;
+	}
+
+	return peekBlobPrimitiveType(static_cast<const char *>(fileData(position + 4 + headerSize)), blobLength);
+}
+
+BlobDataType BlobFileIn::readBlobAt(uint64_t position, BlobDataBuffer & buffer) const
+{
+	uint32_t headerSize = 0;
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
+
+	buffer.type = BLOB_Invalid;
+	buffer.availableBytes = 0;
+
+	if (!readBlobHeader(position, headerSize, blobLength, blobDataType) || !blobDataType || !blobLength ||
+		blobLength >= MAX_BODY_SIZE || position + 4 + headerSize + blobLength > m_FileSize)
+	{
+		std::cerr << "ERROR: invalid blob found at position " << position << std::endl;
+		return BLOB_Invalid;
+	}
+
+	buffer.type = decodeBlob(static_cast<const char *>(fileData(position + 4 + headerSize)), blobLength, blobDataType,
+		buffer.data, buffer.totalBytes, buffer.availableBytes);
+
+	return buffer.type;
+}
+
+void BlobFileIn::setReadLimit(uint64_t position)
+{
+	stopPipeline();
+
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	m_ReadLimit = position;
+}
+
+uint64_t BlobFileIn::findBlobStart(uint64_t position) const
+{
+	const SizeType windowSize = 1 << 20;
+
+	std::vector<char> window;
+	std::vector<char> follower;
+
+	while (position < m_FileSize)
+	{
+		// every candidate of the window is probed with its complete header
+		SizeType length = SizeType(std::min<uint64_t>(windowSize + 4 + MAX_HEADER_SIZE, m_FileSize - position));
+		SizeType scanSize = std::min(windowSize, length);
+
+		const char * data = readDataAt(position, length, window);
+		if (!data)
+			break;
+
+		for (SizeType i = 0; i < scanSize; ++i)
+		{
+			uint64_t blobSize;
+			if (!probeBlobHeader(data + i, length - i, blobSize) || position + i + blobSize > m_FileSize)
+				continue;
+
+			// payload bytes may look like a header by chance, but hardly ever chain to the next one
+			uint64_t next = position + i + blobSize;
+			if (next == m_FileSize)
+				return position + i;
+
+			SizeType nextLength = SizeType(std::min<uint64_t>(4 + MAX_HEADER_SIZE, m_FileSize - next));
+			const char * nextData = readDataAt(next, nextLength, follower);
+
+			uint64_t nextSize;
+			if (nextData && probeBlobHeader(nextData, nextLength, nextSize) && next + nextSize <= m_FileSize)
+				return position + i;
+		}
+
+		position += scanSize;
+	}
+
+	return m_FileSize;
+}
+
+const char * BlobFileIn::readDataAt(uint64_t position, SizeType length, std::vector<char> & /*scratch*/) const
+{
+	if (!m_FileData || position + length > m_FileSize)
+		return NULL;
+
+	return static_cast<const char *>(fileData(position));
+}
+
+PrimitiveType BlobFileIn::peekBlobPrimitiveType(const char * blobData, uint32_t blobLength) const
+{
+	BlobView view;
+	PrimitiveType type = NoPrimitive;
+
+	if (parseBlobView(blobData, blobLength, view))
+		peekViewPrimitiveType(view, false, type);
+
+	return type;
+}
+
+bool BlobFileIn::wantedPrimitiveBlock(const char * data, uint32_t length) const
+{
+	if (!primitiveFilterActive())
+		return true;
+
+	PrimitiveTypeFlags types;
+	uint32_t required;
+	if (!scanPrimitiveGroups(data, length, false, types, required) || !types)
+		return true;
+
+	return types & m_WantedPrimitives;
+}
+
+PrimitiveType BlobFileIn::peekPrimitiveTypeCached(uint64_t position, const char * blobData, uint32_t blobLength)
+{
+	// blobs in memory are peeked again, streams may not be able to read them from the file
+	if (blobData || position != m_PeekPosition)
+	{
+		m_PeekType = blobData ? peekBlobPrimitiveType(blobData, blobLength) : peekPrimitiveType(position);
+		m_PeekPosition = position;
+	}
+
+	return m_PeekType;
+}
+
+BlobFileIn::FilterAction BlobFileIn::peekFilterAction(uint64_t position, uint64_t nextPosition)
+{
+	if (!primitiveFilterActive() || !m_SortedByType)
+		return FILTER_Read;
+
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	return filterAction(BLOB_OSMData, position, nextPosition);
+}
+
+BlobFileIn::FilterAction BlobFileIn::filterAction(BlobDataType blobDataType, uint64_t position, uint64_t nextPosition,
+	const char * blobData, uint32_t blobLength)
+{
+	if (blobDataType != BLOB_OSMData || !primitiveFilterActive() || !m_SortedByType)
+		return FILTER_Read;
+
+	return sortedFilterAction(peekPrimitiveTypeCached(position, blobData, blobLength), nextPosition);
+}
+
+BlobFileIn::FilterAction BlobFileIn::sortedFilterAction(PrimitiveType first, uint64_t nextPosition)
+{
+	if (first == NoPrimitive || (first & m_WantedPrimitives))
+		return FILTER_Read;
+
+	// blobs of sorted files only contain types from their first one up to the first one of the next blob
+	if (!(m_WantedPrimitives & ~((first << 1) - 1)))
+		return FILTER_SkipRest;
+
+	if (nextPosition < m_FileSize && peekPrimitiveTypeCached(nextPosition) == first)
+		return FILTER_Skip;
+
+	return FILTER_Read;
+}
+
+void BlobFileIn::stopPipeline()
+{
+	if (!m_Pipeline)
+		return;
+
+	// continue behind the last blob handed out
+	m_FilePos = m_Pipeline->position();
+
+	delete m_Pipeline;
+	m_Pipeline = NULL;
+}
+
+///NOT thread-safe! Has to be guarded by m_fileLock
+///Accesses m_filePos
+void * BlobFileIn::fileData()
+{
+	return fileData(m_FilePos);
+}
+
+void * BlobFileIn::fileData(SizeType _position) const
+{
+	return static_cast<void *>(&(m_FileData[_position]));
+}
+
+///NOT thread-safe! Has to be guarded by m_fileLock
+///Changes m_filePos
+void BlobFileIn::readBlobHeader(uint32_t & blobLength, osmpbf::BlobDataType & blobDataType)
+{
+	uint32_t headerLength = 0;
+
+	if (readBlobHeader(m_FilePos, headerLength, blobLength, blobDataType))
+		m_FilePos += 4 + headerLength;
+	else if (headerLength && headerLength < MAX_HEADER_SIZE)
+		m_FilePos += 4;
+}
+
+bool BlobFileIn::readBlobHeader(uint64_t position, uint32_t & headerSize, uint32_t & blobLength, osmpbf::BlobDataType & blobDataType) const
+{
+	blobDataType = BLOB_Invalid;
+	headerSize = 0;
+
+	if (!m_FileData || position + 4 > m_FileSize)
+		return false;
+
+	if (m_VerboseOutput) std::cout << "checking blob header ..." << std::endl;
+
+	uint32_t headerLength;
+	::memmove(&headerLength, fileData(position), sizeof(uint32_t));
+	headerLength = osmpbf::net2hostLong(headerLength);
+	headerSize = headerLength;
+
+	if (m_VerboseOutput) std::cout << "header length : " << headerLength << " B" << std::endl;
+
+	if (!headerLength || headerLength >= MAX_HEADER_SIZE || position + 4 + headerLength > m_FileSize)
+	{
+		std::cerr << "ERROR: invalid blob header size found:" << headerLength;
+		if (headerLength >= MAX_HEADER_SIZE)
+			std::cerr << " (max: " << MAX_HEADER_SIZE << ')';
+
+		std::cerr << std::endl;
+		return false;
+	}
+
+	return parseBlobHeader(static_cast<const char *>(fileData(position + 4)), headerLength, blobLength, blobDataType);
+}
+
+bool BlobFileIn::parseBlobHeader(const char * data, uint32_t headerLength, uint32_t & blobLength, osmpbf::BlobDataType & blobDataType) const
+{
+	blobDataType = BLOB_Invalid;
+
+	if (m_VerboseOutput) std::cout << "parsing blob header ..." << std::endl;
+
+	BlobHeader blobHeader;
+
+	if (!blobHeader.ParseFromArray(data, headerLength))
+	{
+		std::cerr << "ERROR: invalid blob header structure" << std::endl;
+
+		if (!blobHeader.has_type())
+			std::cerr << "> no \"type\" field found" << std::endl;
+
+		if (!blobHeader.has_datasize())
+			std::cerr << "> no \"datasize\" field found" << std::endl;
+
+		return false;
+	}
+
+	if (m_VerboseOutput) std::cout << "type : " << blobHeader.type() << std::endl;
+	if (m_VerboseOutput) std::cout << "datasize : " << blobHeader.datasize() << " B ( " << blobHeader.datasize() / 1024.f << " KiB )" << std::endl;
+
+	if (blobHeader.type() == "OSMHeader")
+		blobDataType = BLOB_OSMHeader;
+	else if (blobHeader.type() == "OSMData")
+		blobDataType = BLOB_OSMData;
+
+	blobLength = blobHeader.datasize();
+
+	return true;
+}
+
+BlobDataType BlobFileIn::decodeBlob(const char * blobData, uint32_t blobLength, BlobDataType blobDataType,
+	char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize) const
+{
+	if (m_VerboseOutput) std::cout << "parsing blob ..." << std::endl;
+
+	BlobView view;
+	if (!parseBlobView(blobData, blobLength, view))
+	{
+		std::cerr << "ERROR: invalid blob structure" << std::endl;
+		return BLOB_Invalid;
+	}
+
+	if (!decodeViewPayload(view, buffer, bufferSize, availableDataSize, m_VerboseOutput))
+		return BLOB_Invalid;
+
+	return blobDataType;
+}
+
+BlobDataType BlobFileIn::readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize)
+{
+	std::unique_lock<std::mutex> lck(m_fileLock);
+
+	if (m_PipelineThreads)
+	{
+		if (!m_Pipeline)
+		{
+			if (m_FilePos >= m_ReadLimit)
+				return BLOB_Invalid;
+
+			m_Pipeline = new Pipeline(*this, m_FilePos, m_PipelineThreads, m_PipelineDepth);
+		}
+
+		lck.unlock();
+		return m_Pipeline->pop(buffer, bufferSize, availableDataSize);
+	}
+
+	for (;;)
+	{
+		if (m_FilePos >= m_ReadLimit)
+			return BLOB_Invalid;
+
+		if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+
+		SizeType blobPos = m_FilePos;
+		uint32_t blobLength = 0;
+		BlobDataType blobDataType;
+
+		readBlobHeader(blobLength, blobDataType);
+
+		if (blobLength >= MAX_BODY_SIZE || m_FilePos + blobLength > m_FileSize)
+		{
+			std::cerr << "ERROR: invalid blob size found:" << blobLength << " (max: " << MAX_BODY_SIZE << ')' << std::endl;
+			return BLOB_Invalid;
+		}
+
+		if (!blobDataType || !blobLength)
+		{
+			lck.unlock();
+
+			if (!blobDataType)
+				std::cerr << "ERROR: invalid blob type" << std::endl;
+			if (!blobLength)
+				std::cerr << "ERROR: invalid blob size" << std::endl;
+
+			return BLOB_Invalid;
+		}
+
+		SizeType myFilePos = m_FilePos;
+		m_FilePos += blobLength;
+
+		FilterAction action = filterAction(blobDataType, blobPos, m_FilePos);
+		if (action == FILTER_Skip)
+			continue;
+
+		if (action == FILTER_SkipRest)
+		{
+			m_FilePos = m_FileSize;
+			return BLOB_Invalid;
+		}
+
+		bool filter = blobDataType == BLOB_OSMData && primitiveFilterActive();
+
+		// concurrent callers may still decode blobs in front of this one
+		bool release = m_AccessPattern == ACCESS_Sequential;
+		if (release)
+			m_DecodingPositions.insert(myFilePos);
+
+		lck.unlock();
+
+		BlobDataType result = decodeBlob(static_cast<const char *>(fileData(myFilePos)), blobLength, blobDataType, buffer, bufferSize, availableDataSize);
+
+		if (release)
+		{
+			lck.lock();
+			m_DecodingPositions.erase(m_DecodingPositions.find(myFilePos));
+			releaseConsumed(m_DecodingPositions.empty() ? m_FilePos : *m_DecodingPositions.begin());
+		}
+
+		if (filter && result == BLOB_OSMData && !wantedPrimitiveBlock(buffer, availableDataSize))
+		{
+			if (!lck.owns_lock())
+				lck.lock();
+
+			continue;
+		}
+
+		return result;
+	}
+}
+
+BlobDataType BlobFileIn::readBlobView(BlobView & view)
+{
+	view = BlobView();
+
+	std::unique_lock<std::mutex> lck(m_fileLock);
+
+	if (!blobViewsAvailable())
+	{
+		std::cerr << "ERROR: blob views are only available for mapped files without pipeline mode" << std::endl;
+		return BLOB_Invalid;
+	}
+
+	for (;;)
+	{
+		if (m_FilePos >= m_ReadLimit)
+			return BLOB_Invalid;
+
+		if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+
+		SizeType blobPos = m_FilePos;
+		uint32_t blobLength = 0;
+		BlobDataType blobDataType;
+
+		readBlobHeader(blobLength, blobDataType);
+
+		if (!blobDataType || !blobLength || blobLength >= MAX_BODY_SIZE || m_FilePos + blobLength > m_FileSize)
+		{
+			std::cerr << "ERROR: invalid blob found at position " << m_FilePos << std::endl;
+			return BLOB_Invalid;
+		}
+
+		SizeType myFilePos = m_FilePos;
+		m_FilePos += blobLength;
+
+		FilterAction action = filterAction(blobDataType, blobPos, m_FilePos);
+		if (action == FILTER_Skip)
+			continue;
+
+		if (action == FILTER_SkipRest)
+		{
+			m_FilePos = m_FileSize;
+			return BLOB_Invalid;
+		}
+
+		bool filter = blobDataType == BLOB_OSMData && primitiveFilterActive();
+
+		lck.unlock();
+
+		if (!parseBlobView(static_cast<const char *>(fileData(myFilePos)), blobLength, view))
+		{
+			std::cerr << "ERROR: invalid blob structure" << std::endl;
+			view = BlobView();
+			return BLOB_Invalid;
+		}
+
+		// compressed blobs are checked by the caller after decoding them
+		if (filter && view.isRaw() && !wantedPrimitiveBlock(view.data, view.dataSize))
+		{
+			view = BlobView();
+			lck.lock();
+			continue;
+		}
+
+		view.type = blobDataType;
+		return blobDataType;
+	}
+}
+
+bool BlobFileIn::skipBlob()
+{
+	stopPipeline();
+
+	if (m_FilePos >= m_ReadLimit)
+		return false;
+
+	if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
+	
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	readBlobHeader(blobLength, blobDataType);
+	if (blobLength)
+	{
+		if (m_VerboseOutput) std::cout << "skipping blob" << std::endl;
+
+		m_FilePos += blobLength;
+		return true;
+	}
+	else
+	{
+		std::cerr << "ERROR: invalid blob size" << std::endl;
+		return false;
+	}
+}
+
+
+bool BlobFileIn::atEnd()
+{
+	return position() >= m_ReadLimit;
+}
+
+// BlobStreamIn
+
+BlobStreamIn::BlobStreamIn(const std::string & fileName, uint32_t readBufferSize)
+	: BlobFileIn(fileName),
+	  m_ReadBuffer(NULL),
+	  m_ReadData(NULL),
+	  m_ReadBufferSize(std::max<uint32_t>(readBufferSize, 4096)),
+	  m_ReadBegin(0),
+	  m_ReadEnd(0),
+	  m_StreamPos(0),
+	  m_Seekable(false),
+	  m_EndOfStream(false),
+	  m_OwnsDescriptor(false),
+	  m_AsyncReader(NULL),
+	  m_ReadAheadDepth(0)
+{
+}
+
+BlobStreamIn::~BlobStreamIn()
+{
+	close();
+
+	delete[] m_ReadBuffer;
+
+	for (RawBuffer & buffer : m_RawBuffers)
+		delete[] buffer.data;
+}
+
+bool BlobStreamIn::open()
+{
+	close();
+
+	if (m_VerboseOutput) std::cout << "opening stream " << m_FileName << " ...";
+
+	if (m_FileName == "-")
+	{
+		m_FileDescriptor = 0;
+		m_OwnsDescriptor = false;
+	}
+	else
+	{
+		m_FileDescriptor = osmpbf::open(m_FileName.c_str(), IO_OPEN_READ_ONLY);
+		m_OwnsDescriptor = true;
+	}
+
+	if (m_FileDescriptor < 0)
+	{
+		std::cerr << "ERROR: Could not open file: " << m_FileName << std::endl;
+		return false;
+	}
+
+	m_Seekable = osmpbf::isRegularFile(m_FileDescriptor);
+	m_FileSize = m_Seekable ? osmpbf::fileSize(m_FileDescriptor) : 0;
+	m_ReadLimit = m_Seekable ? m_FileSize : (std::numeric_limits<uint64_t>::max)();
+
+	if (!m_ReadBuffer)
+		m_ReadBuffer = new char[m_ReadBufferSize];
+
+	m_ReadData = m_ReadBuffer;
+	m_ReadBegin = 0;
+	m_ReadEnd = 0;
+	m_StreamPos = 0;
+	m_EndOfStream = false;
+
+	m_ReleasedPos = 0;
+	m_PeekPosition = (std::numeric_limits<uint64_t>::max)();
+	if (m_Seekable)
+		applyAccessPattern();
+
+	if (m_Seekable && m_ReadAheadDepth)
+	{
+		m_AsyncReader = new AsyncReader(m_FileDescriptor, m_FileSize, m_ReadBufferSize, m_ReadAheadDepth);
+		m_AsyncReader->restart(0);
+
+		if (m_VerboseOutput) std::cout << (m_AsyncReader->usingIoUring() ? " (io_uring)" : " (pread)");
+	}
+
+	if (m_VerboseOutput) std::cout << "done" << std::endl;
+	return true;
+}
+
+void BlobStreamIn::close()
+{
+	delete m_AsyncReader;
+	m_AsyncReader = NULL;
+
+	if (m_FileDescriptor > -1)
+	{
+		if (m_VerboseOutput) std::cout << "closing stream ...";
+		if (m_OwnsDescriptor)
+			osmpbf::close(m_FileDescriptor);
+		if (m_VerboseOutput) std::cout << "done" << std::endl;
+
+		m_FileDescriptor = -1;
+	}
+
+	m_ReadBegin = 0;
+	m_ReadEnd = 0;
+}
+
+void BlobStreamIn::seek(OffsetType position)
+{
+	seekStream(uint64_t(position));
+}
+
+void BlobStreamIn::seekStream(uint64_t target)
+{
+	std::lock_guard<std::mutex> lck(m_fileLock);
+
+	if (m_Seekable)
+	{
+		// stay within the buffered data if possible
+		if (target >= m_StreamPos && target <= m_StreamPos + (m_ReadEnd - m_ReadBegin))
+		{
+			m_ReadBegin += uint32_t(target - m_StreamPos);
+			m_StreamPos = target;
+		}
+		else
+		{
+			m_StreamPos = target;
+			resetReadPosition();
+		}
+
+		resetReleasedPosition(m_StreamPos);
+	}
+	else if (target >= m_StreamPos)
+	{
+		skipBytes(target - m_StreamPos);
+	}
+	else
+	{
+		std::cerr << "ERROR: can not seek backwards in stream " << m_FileName << std::endl;
+	}
+}
+
+SizeType BlobStreamIn::position() const
+{
+	return SizeType(streamPosition());
+}
+
+SizeType BlobStreamIn::size() const
+{
+	return SizeType(streamSize());
+}
+
+uint64_t BlobStreamIn::streamPosition() const
+{
+	return m_StreamPos;
+}
+
+uint64_t BlobStreamIn::streamSize() const
+{
+	return m_Seekable ? m_FileSize : m_StreamPos + (m_ReadEnd - m_ReadBegin);
+}
+
+void BlobStreamIn::setPipelineMode(uint32_t threadCount, uint32_t /*queueDepth*/)
+{
+	if (threadCount)
+		std::cerr << "ERROR: pipeline mode is not available for stream " << m_FileName << ", use read-ahead instead" << std::endl;
+}
+
+bool BlobStreamIn::atEnd()
+{
+	std::lock_guard<std::mutex> lck(m_fileLock);
+	return m_StreamPos >= m_ReadLimit || (m_ReadBegin == m_ReadEnd && !fillReadBuffer());
+}
+
+bool BlobStreamIn::fillReadBuffer()
+{
+	if (m_EndOfStream || m_FileDescriptor < 0)
+		return false;
+
+	m_ReadBegin = 0;
+	m_ReadEnd = 0;
+
+	// read-ahead chunks are used in place
+	if (m_AsyncReader)
+	{
+		if (!m_AsyncReader->next(m_ReadData, m_ReadEnd))
+		{
+			m_EndOfStream = true;
+			return false;
+		}
+
+		return true;
+	}
+
+	m_ReadData = m_ReadBuffer;
+
+	SignedSizeType count = readInput(m_ReadBuffer, m_ReadBufferSize);
+	if (count <= 0)
+	{
+		if (count < 0)
+			std::cerr << "ERROR: could not read from " << m_FileName << std::endl;
+
+		m_EndOfStream = true;
+		return false;
+	}
+
+	m_ReadEnd = uint32_t(count);
+	return true;
+}
+
+void BlobStreamIn::resetReadPosition()
+{
+	m_ReadBegin = 0;
+	m_ReadEnd = 0;
+	m_EndOfStream = false;
+
+	// reads without read-ahead continue at m_StreamPos, see readInput()
+	if (m_AsyncReader)
+		m_AsyncReader->restart(m_StreamPos);
+}
+
+SignedSizeType BlobStreamIn::readInput(char * dest, uint32_t count)
+{
+	// regular files are read at m_StreamPos, concurrent pread() calls may move the file pointer (Windows)
+	if (m_Seekable)
+		return osmpbf::pread(m_FileDescriptor, dest, count, m_StreamPos);
+
+	return osmpbf::read(m_FileDescriptor, dest, count);
+}
+
+void BlobStreamIn::setReadAhead(uint32_t queueDepth)
+{
+	std::lock_guard<std::mutex> lck(m_fileLock);
+
+	m_ReadAheadDepth = queueDepth;
+
+	if (m_FileDescriptor < 0 || !m_Seekable)
+		return;
+
+	delete m_AsyncReader;
+	m_AsyncReader = queueDepth ? new AsyncReader(m_FileDescriptor, m_FileSize, m_ReadBufferSize, queueDepth) : NULL;
+
+	resetReadPosition();
+}
+
+bool BlobStreamIn::ioUringActive() const
+{
+	return m_AsyncReader && m_AsyncReader->usingIoUring();
+}
+
+bool BlobStreamIn::readBytes(char * dest, uint32_t count)
+{
+	uint32_t buffered = std::min(count, m_ReadEnd - m_ReadBegin);
+	::memcpy(dest, m_ReadData + m_ReadBegin, buffered);
+	m_ReadBegin += buffered;
+	m_StreamPos += buffered;
+	dest += buffered;
+	count -= buffered;
+
+	// large remainders bypass the read buffer
+	while (!m_AsyncReader && count >= m_ReadBufferSize)
+	{
+		SignedSizeType read = readInput(dest, count);
+		if (read <= 0)
+		{
+			m_EndOfStream = true;
+			return false;
+		}
+
+		m_StreamPos += read;
+		dest += read;
+		count -= uint32_t(read);
+	}
+
+	while (count)
+	{
+		if (m_ReadBegin == m_ReadEnd && !fillReadBuffer())
+			return false;
+
+		buffered = std::min(count, m_ReadEnd - m_ReadBegin);
+		::memcpy(dest, m_ReadData + m_ReadBegin, buffered);
+		m_ReadBegin += buffered;
+		m_StreamPos += buffered;
+		dest += buffered;
+		count -= buffered;
+	}
+
+	return true;
+}
+
+bool BlobStreamIn::skipBytes(uint64_t count)
+{
+	uint32_t buffered = uint32_t(std::min<uint64_t>(count, m_ReadEnd - m_ReadBegin));
+	m_ReadBegin += buffered;
+	m_StreamPos += buffered;
+	count -= buffered;
+
+	if (!count)
+		return true;
+
+	// skips within the read-ahead window keep the reads in flight
+	if (m_Seekable && (!m_AsyncReader || count > m_AsyncReader->readAheadSize()))
+	{
+		m_StreamPos += count;
+		resetReadPosition();
+		return m_StreamPos <= m_FileSize;
+	}
+
+	while (count)
+	{
+		if (!fillReadBuffer())
+			return false;
+
+		buffered = uint32_t(std::min<uint64_t>(count, m_ReadEnd - m_ReadBegin));
+		m_ReadBegin += buffered;
+		m_StreamPos += buffered;
+		count -= buffered;
+	}
+
+	return true;
+}
+
+bool BlobStreamIn::readStreamBlobHeader(uint32_t & blobLength, BlobDataType & blobDataType)
+{
+	blobLength = 0;
+	blobDataType = BLOB_Invalid;
+
+	if (m_VerboseOutput) std::cout << "checking blob header ..." << std::endl;
+
+	uint32_t headerLength;
+	if (!readBytes(reinterpret_cast<char *>(&headerLength), sizeof(uint32_t)))
+	{
+		std::cerr << "ERROR: unexpected end of stream" << std::endl;
+		return false;
+	}
+
+	headerLength = osmpbf::net2hostLong(headerLength);
+
+	if (m_VerboseOutput) std::cout << "header length : " << headerLength << " B" << std::endl;
+
+	if (!headerLength || headerLength >= MAX_HEADER_SIZE)
+	{
+		std::cerr << "ERROR: invalid blob header size found:" << headerLength << std::endl;
+		return false;
+	}
+
+	m_HeaderBuffer.resize(headerLength);
+	if (!readBytes(m_HeaderBuffer.data(), headerLength))
+	{
+		std::cerr << "ERROR: unexpected end of stream" << std::endl;
+		return false;
+	}
+
+	return parseBlobHeader(m_HeaderBuffer.data(), headerLength, blobLength, blobDataType);
+}
+
+BlobDataType BlobStreamIn::readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize)
+{
+	std::unique_lock<std::mutex> lck(m_fileLock);
+
+	for (;;)
+	{
+		if (m_StreamPos >= m_ReadLimit || (m_ReadBegin == m_ReadEnd && !fillReadBuffer()))
+			return BLOB_Invalid;
+
+		if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+
+		uint64_t blobPos = m_StreamPos;
+		uint32_t blobLength = 0;
+		BlobDataType blobDataType;
+
+		if (!readStreamBlobHeader(blobLength, blobDataType))
+			return BLOB_Invalid;
+
+		if (!blobDataType || !blobLength || blobLength >= MAX_BODY_SIZE)
+		{
+			std::cerr << "ERROR: invalid blob found at position " << m_StreamPos << std::endl;
+			return BLOB_Invalid;
+		}
+
+		RawBuffer raw = acquireRawBuffer(blobLength);
+		if (!readBytes(raw.data, blobLength))
+		{
+			std::cerr << "ERROR: unexpected end of stream" << std::endl;
+			releaseRawBuffer(raw);
+			return BLOB_Invalid;
+		}
+
+		// the blob was copied, only read-ahead beyond m_StreamPos is still needed
+		if (m_Seekable)
+			releaseConsumed(m_StreamPos);
+
+		FilterAction action = filterAction(blobDataType, blobPos, m_StreamPos, raw.data, blobLength);
+		if (action != FILTER_Read)
+			releaseRawBuffer(raw);
+
+		if (action == FILTER_Skip)
+			continue;
+
+		if (action == FILTER_SkipRest)
+		{
+			if (m_Seekable)
+			{
+				m_StreamPos = m_FileSize;
+				resetReadPosition();
+			}
+
+			m_ReadBegin = 0;
+			m_ReadEnd = 0;
+			m_EndOfStream = true;
+			return BLOB_Invalid;
+		}
+
+		bool filter = blobDataType == BLOB_OSMData && primitiveFilterActive();
+
+		lck.unlock();
+
+		BlobDataType result = decodeBlob(raw.data, blobLength, blobDataType, buffer, bufferSize, availableDataSize);
+		releaseRawBuffer(raw);
+
+		if (filter && result == BLOB_OSMData && !wantedPrimitiveBlock(buffer, availableDataSize))
+		{
+			lck.lock();
+			continue;
+		}
+
+		return result;
+	}
+}
+
+bool BlobStreamIn::skipBlob()
+{
+	std::lock_guard<std::mutex> lck(m_fileLock);
+
+	if (m_StreamPos >= m_ReadLimit || (m_ReadBegin == m_ReadEnd && !fillReadBuffer()))
+		return false;
+
+	if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
+
+	if (!readStreamBlobHeader(blobLength, blobDataType) || !blobLength)
 	{
-		std::cerr << "ERROR: input file is larger than " << ((std::numeric_limits<SizeType>::max)() >> 30) << " GiB" << std::endl;
-		osmpbf::close(m_FileDescriptor);
-		m_FileDescriptor = -1;
+		std::cerr << "ERROR: invalid blob size" << std::endl;
 		return false;
 	}
 
-	m_FileSize = SizeType(fileSize);
+	if (m_VerboseOutput) std::cout << "skipping blob" << std::endl;
 
-	m_FileData = (char *) mmap(0, m_FileSize, MM_PROT_READ, MM_MAP_SHARED, m_FileDescriptor, 0);
+	return skipBytes(blobLength);
+}
 
-	if (!osmpbf::validMmapAddress(m_FileData))
+bool BlobStreamIn::readBlobHeader(uint64_t position, uint32_t & headerSize, uint32_t & blobLength, BlobDataType & blobDataType) const
+{
+	blobDataType = BLOB_Invalid;
+	headerSize = 0;
+
+	if (!m_Seekable || m_FileDescriptor < 0 || position + 4 > m_FileSize)
+		return false;
+
+	uint32_t headerLength;
+	if (osmpbf::pread(m_FileDescriptor, &headerLength, sizeof(uint32_t), position) != sizeof(uint32_t))
+		return false;
+
+	headerLength = osmpbf::net2hostLong(headerLength);
+	headerSize = headerLength;
+
+	if (!headerLength || headerLength >= MAX_HEADER_SIZE || position + 4 + headerLength > m_FileSize)
 	{
-		std::cerr << "ERROR: could not mmap file" << std::endl;
-		osmpbf::close(m_FileDescriptor);
-		m_FileDescriptor = -1;
-		m_FileData = NULL;
+		std::cerr << "ERROR: invalid blob header size found:" << headerLength << std::endl;
 		return false;
 	}
 
-	if (m_VerboseOutput) std::cout << "done" << std::endl;
-	return true;
+	std::vector<char> header(headerLength);
+	if (osmpbf::pread(m_FileDescriptor, header.data(), headerLength, position + 4) != SignedSizeType(headerLength))
+		return false;
+
+	return parseBlobHeader(header.data(), headerLength, blobLength, blobDataType);
 }
 
-void BlobFileIn::close()
+PrimitiveType BlobStreamIn::peekPrimitiveType(uint64_t position) const
 {
-	if (m_FileData)
+	uint32_t headerSize = 0;
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
+
+	if (!readBlobHeader(position, headerSize, blobLength, blobDataType) || blobDataType != BLOB_OSMData ||
+		blobLength >= MAX_BODY_SIZE || position + 4 + headerSize + blobLength > m_FileSize)
 	{
-		if (m_VerboseOutput) std::cout << "closing file ...";
-		osmpbf::munmap(m_FileData, m_FileSize);
-		osmpbf::close(m_FileDescriptor);
-		if (m_VerboseOutput) std::cout << "done" << std::endl;
+		return NoPrimitive;
+	}
 
-		m_FileData = NULL;
+	uint64_t blobPosition = position + 4 + headerSize;
+	std::vector<char> scratch;
+
+	// the first group follows the string table, so a prefix of the compressed blob usually suffices
+	for (uint32_t prefixLength = std::min<uint32_t>(blobLength, 16 << 10);; prefixLength = std::min(blobLength, 4 * prefixLength))
+	{
+		const char * data = readDataAt(blobPosition, prefixLength, scratch);
+		if (!data)
+			return NoPrimitive;
+
+		if (prefixLength == blobLength)
+			return peekBlobPrimitiveType(data, blobLength);
+
+		BlobView view;
+		PrimitiveType type;
+		if (parseBlobViewPrefix(data, prefixLength, view) && peekViewPrimitiveType(view, true, type))
+			return type;
 	}
 }
 
-void BlobFileIn::seek(OffsetType position)
+BlobDataType BlobStreamIn::readBlobAt(uint64_t position, BlobDataBuffer & buffer) const
 {
-	m_FilePos = position;
-}
+	uint32_t headerSize = 0;
+	uint32_t blobLength = 0;
+	BlobDataType blobDataType;
 
-SizeType BlobFileIn::position() const
-{
-	return m_FilePos;
+	buffer.type = BLOB_Invalid;
+	buffer.availableBytes = 0;
+
+	if (!readBlobHeader(position, headerSize, blobLength, blobDataType) || !blobDataType || !blobLength ||
+		blobLength >= MAX_BODY_SIZE || position + 4 + headerSize + blobLength > m_FileSize)
+	{
+		std::cerr << "ERROR: invalid blob found at position " << position << std::endl;
+		return BLOB_Invalid;
+	}
+
+	std::vector<char> blob(blobLength);
+	if (osmpbf::pread(m_FileDescriptor, blob.data(), blobLength, position + 4 + headerSize) != SignedSizeType(blobLength))
+	{
+		std::cerr << "ERROR: could not read blob at position " << position << std::endl;
+		return BLOB_Invalid;
+	}
+
+	buffer.type = decodeBlob(blob.data(), blobLength, blobDataType, buffer.data, buffer.totalBytes, buffer.availableBytes);
+	return buffer.type;
 }
 
-SizeType BlobFileIn::size() const
+const char * BlobStreamIn::readDataAt(uint64_t position, SizeType length, std::vector<char> & scratch) const
 {
-	return m_FileSize;
+	if (!m_Seekable || m_FileDescriptor < 0 || position + length > m_FileSize)
+		return NULL;
+
+	scratch.resize(length);
+	if (osmpbf::pread(m_FileDescriptor, scratch.data(), length, position) != SignedSizeType(length))
+		return NULL;
+
+	return scratch.data();
 }
 
-void BlobFileIn::readBlob(BlobDataBuffer & buffer)
+BlobStreamIn::RawBuffer BlobStreamIn::acquireRawBuffer(uint32_t size)
 {
-	buffer.type = readBlob(buffer.data, buffer.totalBytes, buffer.availableBytes);
-}
+	RawBuffer buffer = {NULL, 0};
 
-constexpr uint32_t MAX_HEADER_SIZE = 64 << 10;
-constexpr uint32_t MAX_BODY_SIZE = 32 << 20;
+	{
+		std::lock_guard<std::mutex> lck(m_RawBuffersLock);
+		if (!m_RawBuffers.empty())
+		{
+			buffer = m_RawBuffers.back();
+			m_RawBuffers.pop_back();
+		}
+	}
 
-///NOT thread-safe! Has to be guarded by m_fileLock
-///Accesses m_filePos
-void * BlobFileIn::fileData()
-{
-	return fileData(m_FilePos);
+	if (buffer.size < size)
+	{
+		delete[] buffer.data;
+		buffer.data = new char[size];
+		buffer.size = size;
+	}
+
+	return buffer;
 }
 
-void * BlobFileIn::fileData(SizeType _position)
+void BlobStreamIn::releaseRawBuffer(const RawBuffer & buffer)
 {
-	return static_cast<void *>(&(m_FileData[_position]));
+	std::lock_guard<std::mutex> lck(m_RawBuffersLock);
+	m_RawBuffers.push_back(buffer);
 }
 
-///NOT thread-safe! Has to be guarded by m_fileLock
-///Changes m_filePos
-void BlobFileIn::readBlobHeader(uint32_t & blobLength, osmpbf::BlobDataType & blobDataType)
+
+// BlobFileOut::Compressor
+
+/**
+ * Worker pool compressing queued blobs. A single writer thread writes the finished
+ * blocks in submission order; slots are recycled so their buffers are reused.
+ */
+class BlobFileOut::Compressor
 {
-	blobDataType = BLOB_Invalid;
+public:
+	Compressor(BlobFileOut & file, uint32_t threadCount, uint32_t queueDepth);
+	~Compressor();
 
-	if (m_VerboseOutput) std::cout << "checking blob header ..." << std::endl;
+	///queue a copy of @data, @return false if a previously queued blob failed
+	bool push(BlobDataType type, const char * data, uint32_t dataSize, bool compress, BlobCompression compression, int level);
 
-	uint32_t headerLength;
-	::memmove(&headerLength, fileData(), sizeof(uint32_t));
-	headerLength = osmpbf::net2hostLong(headerLength);
+	///wait until all queued blobs are written, @return false if any of them failed, the failure is kept
+	bool wait();
+	///like wait() but clears the failure once it is reported
+	bool flush();
 
-	if (m_VerboseOutput) std::cout << "header length : " << headerLength << " B" << std::endl;
+private:
+	enum SlotState { SLOT_Free, SLOT_Queued, SLOT_Compressing, SLOT_Done };
 
-	if (!headerLength || headerLength >= MAX_HEADER_SIZE)
+	struct Slot
 	{
-		std::cerr << "ERROR: invalid blob header size found:" << headerLength;
-		if (headerLength >= MAX_HEADER_SIZE)
-			std::cerr << " (max: " << MAX_HEADER_SIZE << ')';
+		SlotState state = SLOT_Free;
+		bool ok = false;
 
-		std::cerr << std::endl;
-		return;
-	}
+		BlobDataType type = BLOB_Invalid;
+		bool compress = false;
+		BlobCompression compression = COMPRESSION_None;
+		int level = -1;
 
-	m_FilePos += 4;
+		char * input = nullptr;
+		uint32_t inputSize = 0;
+		uint32_t inputCapacity = 0;
 
-	if (m_VerboseOutput) std::cout << "parsing blob header ..." << std::endl;
+		char * compressed = nullptr;
+		uint32_t compressedCapacity = 0;
 
-	BlobHeader * blobHeader = new BlobHeader();
+		std::string block;
+	};
 
-	if (!blobHeader->ParseFromArray(fileData(), headerLength))
-	{
-		std::cerr << "ERROR: invalid blob header structure" << std::endl;
+	void workerFunc();
+	void writerFunc();
 
-		if (!blobHeader->has_type())
-			std::cerr << "> no \"type\" field found" << std::endl;
+	BlobFileOut & m_File;
 
-		if (!blobHeader->has_datasize())
-			std::cerr << "> no \"datasize\" field found" << std::endl;
-	}
-	else
-	{
-		m_FilePos += headerLength;
+	std::vector<Slot> m_Slots;
 
-		if (m_VerboseOutput) std::cout << "type : " << blobHeader->type() << std::endl;
-		if (m_VerboseOutput) std::cout << "datasize : " << blobHeader->datasize() << " B ( " << blobHeader->datasize() / 1024.f << " KiB )" << std::endl;
+	// sequence numbers of queued, taken by a worker and written blobs
+	uint64_t m_SubmitSeq;
+	uint64_t m_CompressSeq;
+	uint64_t m_WriteSeq;
 
-		if (blobHeader->type() == "OSMHeader")
-			blobDataType = BLOB_OSMHeader;
-		else if (blobHeader->type() == "OSMData")
-			blobDataType = BLOB_OSMData;
+	bool m_Failed;
+	bool m_Stop;
 
-		blobLength = blobHeader->datasize();
-	}
+	std::mutex m_Lock;
+	std::condition_variable m_SlotFreed;
+	std::condition_variable m_BlobQueued;
+	std::condition_variable m_BlobDone;
+
+	std::vector<std::thread> m_Threads;
+};
 
-	delete blobHeader;
+BlobFileOut::Compressor::Compressor(BlobFileOut & file, uint32_t threadCount, uint32_t queueDepth) :
+	m_File(file),
+	m_Slots(std::max<uint32_t>(queueDepth, 1)),
+	m_SubmitSeq(0),
+	m_CompressSeq(0),
+	m_WriteSeq(0),
+	m_Failed(false),
+	m_Stop(false)
+{
+	m_Threads.reserve(threadCount + 1);
+	m_Threads.emplace_back(&Compressor::writerFunc, this);
+	for (uint32_t i = 0; i < threadCount; ++i)
+		m_Threads.emplace_back(&Compressor::workerFunc, this);
 }
 
-BlobDataType BlobFileIn::readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize)
+BlobFileOut::Compressor::~Compressor()
 {
-	//we do some "speculative" pre-allocation here to reduce the time spend in the lock
-	std::unique_ptr<Blob> blob(new Blob());
-	
-	std::unique_lock<std::mutex> lck(m_fileLock);
-	if (m_FilePos >= m_FileSize)
-		return BLOB_Invalid;
+	wait();
 
-	if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+	{
+		std::lock_guard<std::mutex> lck(m_Lock);
+		m_Stop = true;
+	}
 
-	uint32_t blobLength = 0;
-	BlobDataType blobDataType;
+	m_BlobQueued.notify_all();
+	m_BlobDone.notify_all();
 
-	readBlobHeader(blobLength, blobDataType);
+	for (std::thread & t : m_Threads)
+		t.join();
 
-	if (blobLength >= MAX_BODY_SIZE)
+	for (Slot & slot : m_Slots)
 	{
-		std::cerr << "ERROR: invalid blob size found:" << blobLength << " (max: " << MAX_BODY_SIZE << ')' << std::endl;
-		return BLOB_Invalid;
+		delete[] slot.input;
+		delete[] slot.compressed;
 	}
-	
-	if (blobDataType && blobLength)
-	{
-		SizeType myFilePos = m_FilePos;
-		m_FilePos += blobLength;
-		lck.unlock();
-		
-		if (m_VerboseOutput) std::cout << "parsing blob ..." << std::endl;
+}
 
-		if (!blob->ParseFromArray(fileData(myFilePos), blobLength))
-		{
-			std::cerr << "ERROR: invalid blob structure" << std::endl;
-			return BLOB_Invalid;
-		}
+bool BlobFileOut::Compressor::push(BlobDataType type, const char * data, uint32_t dataSize, bool compress, BlobCompression compression, int level)
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	m_SlotFreed.wait(lck, [this]() { return m_SubmitSeq < m_WriteSeq + m_Slots.size(); });
 
-		if (blob->has_raw_size())
-		{
-			if (m_VerboseOutput) std::cout << "found compressed blob data" << std::endl;
-			if (m_VerboseOutput) std::cout << "uncompressed size : " << blob->raw_size() << "B ( " << blob->raw_size() / 1024.f << " KiB )" << std::endl;
+	// failures stay set until flush() reports them
+	bool result = !m_Failed;
 
-			std::string * compressedData = blob->release_zlib_data();
-			availableDataSize = blob->raw_size();
+	// a free slot is not touched by the workers until it is queued
+	Slot & slot = m_Slots[m_SubmitSeq % m_Slots.size()];
+	lck.unlock();
 
-			blob.reset(0);
+	if (slot.inputCapacity < dataSize)
+	{
+		delete[] slot.input;
+		slot.input = new char[dataSize];
+		slot.inputCapacity = dataSize;
+	}
 
-			if (bufferSize < availableDataSize)
-			{
-				if (buffer) delete[] buffer;
-				buffer = new char[availableDataSize];
+	if (dataSize)
+		memcpy(slot.input, data, dataSize);
 
-				bufferSize = availableDataSize;
-			}
+	slot.inputSize = dataSize;
+	slot.type = type;
+	slot.compress = compress;
+	slot.compression = compression;
+	slot.level = level;
 
-			if (m_VerboseOutput) std::cout << "decompressing data ... ";
-			
-			assert(compressedData->length() < std::numeric_limits<uint32_t>::max());
-			inflateData(compressedData->data(), (uint32_t) compressedData->length(), buffer, availableDataSize);
+	lck.lock();
+	slot.state = SLOT_Queued;
+	++m_SubmitSeq;
+	lck.unlock();
 
-			if (m_VerboseOutput) std::cout << "done" << std::endl;
+	m_BlobQueued.notify_one();
 
-			delete compressedData;
-		}
-		else
-		{
-			if (m_VerboseOutput) std::cout << "found uncompressed blob data" << std::endl;
+	return result;
+}
 
-			std::string * uncompressedData = blob->release_raw();
-			assert(uncompressedData->length() < std::numeric_limits<uint32_t>::max());
-			availableDataSize = (uint32_t) uncompressedData->length();
+bool BlobFileOut::Compressor::wait()
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	m_SlotFreed.wait(lck, [this]() { return m_WriteSeq == m_SubmitSeq; });
 
-			blob.reset(0);
+	return !m_Failed;
+}
 
-			if (bufferSize < availableDataSize)
-			{
-				if (buffer) delete[] buffer;
-				buffer = new char[availableDataSize];
+bool BlobFileOut::Compressor::flush()
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	m_SlotFreed.wait(lck, [this]() { return m_WriteSeq == m_SubmitSeq; });
 
-				bufferSize = availableDataSize;
-			}
+	bool result = !m_Failed;
+	m_Failed = false;
+	return result;
+}
 
-			memmove(buffer, uncompressedData->data(), availableDataSize);
-			delete uncompressedData;
-		}
+void BlobFileOut::Compressor::workerFunc()
+{
+	std::unique_lock<std::mutex> lck(m_Lock);
+	for (;;)
+	{
+		m_BlobQueued.wait(lck, [this]() { return m_Stop || m_CompressSeq < m_SubmitSeq; });
 
-		return blobDataType;
-	}
-	lck.unlock();
+		if (m_Stop)
+			break;
 
-	if (!blobDataType)
-		std::cerr << "ERROR: invalid blob type" << std::endl;
-	if (!blobLength)
-		std::cerr << "ERROR: invalid blob size" << std::endl;
+		Slot & slot = m_Slots[m_CompressSeq % m_Slots.size()];
+		slot.state = SLOT_Compressing;
+		++m_CompressSeq;
+
+		// the slot is owned by this thread until it is marked as done
+		lck.unlock();
+		slot.ok = m_File.encodeBlob(slot.type, slot.input, slot.inputSize, slot.compress, slot.compression, slot.level,
+			slot.compressed, slot.compressedCapacity, slot.block);
+		lck.lock();
 
-	return BLOB_Invalid;
+		slot.state = SLOT_Done;
+		m_BlobDone.notify_all();
+	}
 }
 
-bool BlobFileIn::skipBlob()
+void BlobFileOut::Compressor::writerFunc()
 {
-	if (m_FilePos >= m_FileSize)
-		return false;
+	std::unique_lock<std::mutex> lck(m_Lock);
+	for (;;)
+	{
+		m_BlobDone.wait(lck, [this]() {
+			return (m_Stop && m_WriteSeq == m_SubmitSeq) ||
+				(m_WriteSeq < m_SubmitSeq && m_Slots[m_WriteSeq % m_Slots.size()].state == SLOT_Done);
+		});
 
-	if (m_VerboseOutput) std::cout << "== blob ==" << std::endl;
+		if (m_WriteSeq == m_SubmitSeq)
+			break;
 
-	uint32_t blobLength;
-	BlobDataType blobDataType;
-	
-	std::lock_guard<std::mutex> lck(m_fileLock);
-	readBlobHeader(blobLength, blobDataType);
-	if (blobLength)
-	{
-		if (m_VerboseOutput) std::cout << "skipping blob" << std::endl;
+		Slot & slot = m_Slots[m_WriteSeq % m_Slots.size()];
 
-		m_FilePos += blobLength;
-		return true;
-	}
-	else
-	{
-		std::cerr << "ERROR: invalid blob size" << std::endl;
-		return false;
+		lck.unlock();
+		bool ok = slot.ok && m_File.writeBlock(slot.block);
+		lck.lock();
+
+		if (!ok)
+			m_Failed = true;
+
+		slot.state = SLOT_Free;
+		++m_WriteSeq;
+		m_SlotFreed.notify_all();
 	}
 }
 
+// BlobFileOut
 
 BlobFileOut::BlobFileOut(const std::string & fileName)
-	: AbstractBlobFile(fileName), m_CurrentSize(0)
+	: AbstractBlobFile(fileName),
+	  m_CurrentSize(0),
+	  m_Compression(COMPRESSION_Zlib),
+	  m_CompressionLevel(-1),
+	  m_Compressor(NULL),
+	  m_CompressorThreads(0),
+	  m_CompressorDepth(0),
+	  m_WriteFailed(false),
+	  m_CompressBuffer(NULL),
+	  m_CompressBufferSize(0)
 {
 }
 
 BlobFileOut::~BlobFileOut()
 {
 	close();
+	delete[] m_CompressBuffer;
 }
 
 bool BlobFileOut::open()
 {
+	close();
+
 	if (m_VerboseOutput) std::cout << "opening/creating File " << m_FileName << " ...";
 
 	m_FileDescriptor = osmpbf::open(m_FileName.c_str(), IO_OPEN_WRITE_ONLY | IO_OPEN_CREATE | IO_OPEN_TRUNCATE, 0666);
+	m_CurrentSize = 0;
+	m_WriteFailed = false;
 
 	if (m_VerboseOutput) std::cout << "done" << std::endl;
 
@@ -442,29 +2186,100 @@ bool BlobFileOut::open()
 
 void BlobFileOut::close()
 {
+	stopCompressor();
+
+	if (m_WriteFailed)
+	{
+		std::cerr << "ERROR: not all blobs were written to " << m_FileName << std::endl;
+		m_WriteFailed = false;
+	}
+
 	if (m_FileDescriptor > -1)
 	{
 		if (m_VerboseOutput) std::cout << "closing File " << m_FileName << " ...";
 		osmpbf::close(m_FileDescriptor);
 		if (m_VerboseOutput) std::cout << "done" << std::endl;
+
+		m_FileDescriptor = -1;
 	}
 }
 
 void BlobFileOut::seek(OffsetType position)
 {
+	// the failure is kept for flush() and close()
+	if ((m_Compressor && !m_Compressor->wait()) || m_WriteFailed)
+		std::cerr << "ERROR: seeking in " << m_FileName << " after failed blob writes" << std::endl;
+
 	osmpbf::lseek(m_FileDescriptor, position, IO_SEEK_SET);
 }
 
 SizeType BlobFileOut::position() const
 {
+	if (m_Compressor)
+		m_Compressor->wait();
+
 	return osmpbf::lseek(m_FileDescriptor, 0, IO_SEEK_CUR);
 }
 
 SizeType BlobFileOut::size() const
 {
+	if (m_Compressor)
+		m_Compressor->wait();
+
 	return m_CurrentSize;
 }
 
+bool BlobFileOut::setCompression(BlobCompression compression)
+{
+	if (!compressionSupported(compression))
+	{
+		std::cerr << "ERROR: " << compressionName(compression) << " compression is not supported by this build" << std::endl;
+		return false;
+	}
+
+	m_Compression = compression;
+	return true;
+}
+
+bool BlobFileOut::isCompressionSupported(BlobCompression compression)
+{
+	return compressionSupported(compression);
+}
+
+void BlobFileOut::setCompressionLevel(int level)
+{
+	m_CompressionLevel = level;
+}
+
+void BlobFileOut::setCompressionThreads(uint32_t threadCount, uint32_t queueDepth)
+{
+	stopCompressor();
+
+	m_CompressorThreads = threadCount;
+	m_CompressorDepth = queueDepth ? queueDepth : 2 * threadCount;
+}
+
+bool BlobFileOut::flush()
+{
+	bool result = !m_WriteFailed;
+	m_WriteFailed = false;
+
+	if (m_Compressor && !m_Compressor->flush())
+		result = false;
+
+	return result;
+}
+
+void BlobFileOut::stopCompressor()
+{
+	// keep failures of the last queued blobs for flush() or close()
+	if (m_Compressor && !m_Compressor->flush())
+		m_WriteFailed = true;
+
+	delete m_Compressor;
+	m_Compressor = NULL;
+}
+
 bool BlobFileOut::writeBlob(const BlobDataBuffer & buffer, bool compress)
 {
 	return writeBlob(buffer.type, buffer.data, buffer.availableBytes, compress);
@@ -475,96 +2290,113 @@ bool BlobFileOut::writeBlob(osmpbf::BlobDataType type, const char * buffer, uint
 	if (type == BLOB_Invalid)
 		return false;
 
+	if (m_CompressorThreads)
+	{
+		if (!m_Compressor)
+			m_Compressor = new Compressor(*this, m_CompressorThreads, m_CompressorDepth);
+
+		return m_Compressor->push(type, buffer, bufferSize, compress, m_Compression, m_CompressionLevel);
+	}
+
+	if (!encodeBlob(type, buffer, bufferSize, compress, m_Compression, m_CompressionLevel, m_CompressBuffer, m_CompressBufferSize, m_BlockBuffer))
+		return false;
+
+	return writeBlock(m_BlockBuffer);
+}
+
+bool BlobFileOut::encodeBlob(BlobDataType type, const char * buffer, uint32_t bufferSize, bool compress,
+	BlobCompression compression, int level, char * & compressBuffer, uint32_t & compressBufferSize, std::string & block) const
+{
 	if (m_VerboseOutput) std::cout << "preparing blob data:" << std::endl;
-	Blob * blob = new Blob();
 
-	if (compress)
-	{
-		char * zlibBuffer = NULL;
-		uint32_t zlibBufferSize = 0;
-		uint32_t zlibDataAvailable = 0;
+	const char * payload = buffer;
+	uint32_t payloadSize = bufferSize;
+	uint32_t payloadField = 1;
 
-		if (m_VerboseOutput) std::cout << "compressing data ... ";
-		zlibDataAvailable = deflateData(buffer, bufferSize, zlibBuffer, zlibBufferSize);
+	if (compress && compression != COMPRESSION_None)
+	{
+		if (m_VerboseOutput) std::cout << "compressing data (" << compressionName(compression) << ") ... ";
+		payloadSize = compressData(compression, level, buffer, bufferSize, compressBuffer, compressBufferSize);
 		if (m_VerboseOutput) std::cout << "done" << std::endl;
 
-		blob->set_raw_size(bufferSize);
-		blob->set_zlib_data((void *)zlibBuffer, zlibDataAvailable);
-		delete[] zlibBuffer;
+		if (!payloadSize)
+			return false;
+
+		payload = compressBuffer;
+		payloadField = fieldForCompression(compression);
 	}
 	else
 	{
 		if (m_VerboseOutput) std::cout << " <no compression requested>" << std::endl;
-		blob->set_raw((void *)buffer, bufferSize);
 	}
 
-	if (!blob->IsInitialized())
-	{
-		std::cerr << "blob not initialized" << std::endl;
-		return false;
-	}
+	const char * typeName = (type == BLOB_OSMHeader) ? "OSMHeader" : "OSMData";
+	uint32_t typeNameLength = (uint32_t) strlen(typeName);
 
-	std::string serializedBlobBuffer = blob->SerializeAsString();
-	delete blob;
+	// fields are emitted in field number order, like the protobuf serializer does
+	uint64_t blobSize = 0;
+	if (payloadField != 1)
+		blobSize += 1 + varintSize(bufferSize);
+	blobSize += 1 + varintSize(payloadSize) + payloadSize;
 
-	if (!serializedBlobBuffer.length())
+	if (blobSize >= MAX_BODY_SIZE)
 	{
-		std::cerr << "serializedBlobBuffer failed" << std::endl;
+		std::cerr << "ERROR: blob too large: " << blobSize << std::endl;
 		return false;
 	}
 
-	BlobHeader * blobHeader = new BlobHeader();
-	assert(serializedBlobBuffer.length() < std::size_t{std::numeric_limits<::google::protobuf::int32>::max()});
-	blobHeader->set_datasize((::google::protobuf::int32) serializedBlobBuffer.length());
-	switch (type)
-	{
-	case BLOB_OSMData:
-		blobHeader->set_type("OSMData");
-		break;
-	case BLOB_OSMHeader:
-		blobHeader->set_type("OSMHeader");
-		break;
-	default:
-		break;
-	}
+	uint32_t headerSize = 1 + varintSize(typeNameLength) + typeNameLength + 1 + varintSize(blobSize);
 
-	if (!blobHeader->IsInitialized())
-	{
-		std::cerr << "blobHeader not initialized" << std::endl;
-		delete blobHeader;
-		return false;
-	}
+	block.clear();
+	block.reserve(4 + headerSize + blobSize);
 
-	if (m_VerboseOutput) std::cout << "writing blob...";
+	uint32_t netHeaderSize = osmpbf::host2NetLong(headerSize);
+	block.append(reinterpret_cast<const char *>(&netHeaderSize), sizeof(uint32_t));
 
-	// save position and skip header size
-	off_t headerSizePosition = osmpbf::lseek(m_FileDescriptor, 0, IO_SEEK_CUR);
-	osmpbf::lseek(m_FileDescriptor, sizeof(uint32_t), IO_SEEK_CUR);
+	// BlobHeader: type = 1, datasize = 3
+	appendVarint(block, (1 << 3) | WIRE_LengthDelimited);
+	appendVarint(block, typeNameLength);
+	block.append(typeName, typeNameLength);
+	appendVarint(block, (3 << 3) | WIRE_Varint);
+	appendVarint(block, blobSize);
 
-	// serialize header blob
-	if (!blobHeader->SerializeToFileDescriptor(m_FileDescriptor))
+	// Blob: raw_size = 2, payload
+	if (payloadField != 1)
 	{
-		std::cerr << "error writing blobHeader" << std::endl;
-		delete blobHeader;
-		return false;
+		appendVarint(block, (2 << 3) | WIRE_Varint);
+		appendVarint(block, bufferSize);
 	}
 
-	off_t blobPosition = osmpbf::lseek(m_FileDescriptor, 0, IO_SEEK_CUR);
+	appendVarint(block, (payloadField << 3) | WIRE_LengthDelimited);
+	appendVarint(block, payloadSize);
+	block.append(payload, payloadSize);
+
+	return true;
+}
+
+bool BlobFileOut::writeBlock(const std::string & block)
+{
+	if (m_VerboseOutput) std::cout << "writing blob...";
+
+	const char * data = block.data();
+	SizeType remaining = block.size();
 
-	// write header size
-	std::size_t headerSize = blobHeader->ByteSizeLong();
-	headerSize = osmpbf::host2NetLong(headerSize);
-	osmpbf::lseek(m_FileDescriptor, headerSizePosition, IO_SEEK_SET);
-	osmpbf::write(m_FileDescriptor, &headerSize, sizeof(uint32_t));
-	osmpbf::lseek(m_FileDescriptor, blobPosition, IO_SEEK_SET);
+	while (remaining)
+	{
+		SignedSizeType written = osmpbf::write(m_FileDescriptor, data, remaining);
+		if (written <= 0)
+		{
+			std::cerr << "ERROR: could not write blob to " << m_FileName << std::endl;
+			return false;
+		}
 
-	delete blobHeader;
+		data += written;
+		remaining -= written;
+	}
 
-	// write blob
-	osmpbf::write(m_FileDescriptor, (void *) serializedBlobBuffer.data(), serializedBlobBuffer.length());
 	if (m_VerboseOutput) std::cout << "done" << std::endl;
 
-	SizeType pos = position();
+	SizeType pos = osmpbf::lseek(m_FileDescriptor, 0, IO_SEEK_CUR);
 	if (m_CurrentSize < pos)
 		m_CurrentSize = pos;
 
@@ -0,0 +1,279 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#include <osmpbf/blobindex.h>
+#include <osmpbf/blobfile.h>
+
+#include "osmformat.pb.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+namespace osmpbf
+{
+
+static_assert(sizeof(BlobIndexEntry) == 40, "BlobIndexEntry is stored as is in index files");
+static_assert(std::is_trivially_copyable<BlobIndexEntry>::value, "BlobIndexEntry is stored as is in index files");
+
+namespace
+{
+
+const char INDEX_MAGIC[8] = {'O', 'S', 'M', 'P', 'B', 'F', 'B', 'I'};
+const uint32_t INDEX_VERSION = 1;
+const uint32_t INDEX_BYTE_ORDER_MARK = 0x01020304;
+
+struct IndexFileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+	uint64_t fileSize;
+	uint64_t startPosition;
+	uint32_t entrySize;
+	uint32_t primitiveInfo;
+	uint64_t entryCount;
+};
+
+void updatePrimitiveInfo(const crosby::binary::PrimitiveGroup & group, BlobIndexEntry & entry)
+{
+	PrimitiveType type = NoPrimitive;
+	int64_t firstId = 0;
+	int64_t lastId = 0;
+
+	if (group.nodes_size())
+	{
+		type = NodePrimitive;
+		firstId = group.nodes(0).id();
+		lastId = group.nodes(group.nodes_size() - 1).id();
+	}
+	else if (group.has_dense() && group.dense().id_size())
+	{
+		type = NodePrimitive;
+		firstId = group.dense().id(0);
+		lastId = 0;
+		for (int i = 0; i < group.dense().id_size(); ++i)
+			lastId += group.dense().id(i);
+	}
+	else if (group.ways_size())
+	{
+		type = WayPrimitive;
+		firstId = group.ways(0).id();
+		lastId = group.ways(group.ways_size() - 1).id();
+	}
+	else if (group.relations_size())
+	{
+		type = RelationPrimitive;
+		firstId = group.relations(0).id();
+		lastId = group.relations(group.relations_size() - 1).id();
+	}
+
+	if (type == NoPrimitive)
+		return;
+
+	if (entry.primitiveTypes == NoPrimitive)
+		entry.firstId = firstId;
+
+	entry.lastId = lastId;
+	entry.primitiveTypes |= type;
+}
+
+} // anonymous namespace
+
+BlobIndex::BlobIndex() :
+	m_FileSize(0),
+	m_StartPosition(0),
+	m_PrimitiveInfo(false)
+{}
+
+bool BlobIndex::build(BlobFileIn & file, SizeType startPosition, bool primitiveInfo)
+{
+	clear();
+
+	m_FileSize = file.size();
+	m_StartPosition = startPosition;
+	m_PrimitiveInfo = primitiveInfo;
+
+	SizeType position = startPosition;
+
+	bool ok = true;
+	while (position < file.size())
+	{
+		BlobIndexEntry entry;
+		::memset(&entry, 0, sizeof(BlobIndexEntry));
+
+		entry.offset = position;
+
+		if (!file.readBlobHeader(position, entry.headerSize, entry.dataSize, entry.type) || entry.endOffset() > file.size())
+		{
+			std::cerr << "ERROR: could not index blob at position " << position << std::endl;
+			ok = false;
+			break;
+		}
+
+		if (primitiveInfo && entry.type == BLOB_OSMData)
+			readPrimitiveInfo(file, entry);
+
+		m_Entries.push_back(entry);
+		position = entry.endOffset();
+	}
+
+	if (!ok)
+		clear();
+
+	return ok;
+}
+
+bool BlobIndex::load(const std::string & fileName)
+{
+	clear();
+
+	std::ifstream in(fileName, std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	IndexFileHeader header;
+	if (!in.read(reinterpret_cast<char *>(&header), sizeof(IndexFileHeader)))
+		return false;
+
+	if (::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) ||
+		header.version != INDEX_VERSION ||
+		header.byteOrderMark != INDEX_BYTE_ORDER_MARK ||
+		header.entrySize != sizeof(BlobIndexEntry))
+	{
+		std::cerr << "ERROR: invalid or incompatible blob index file: " << fileName << std::endl;
+		return false;
+	}
+
+	// the count is checked against the file before allocating, corrupt counts must not throw
+	std::streamoff entriesBegin = in.tellg();
+	in.seekg(0, std::ios::end);
+	uint64_t entriesLength = uint64_t(in.tellg() - entriesBegin);
+	in.seekg(entriesBegin);
+
+	if (!in || header.entryCount > entriesLength / sizeof(BlobIndexEntry))
+	{
+		std::cerr << "ERROR: truncated blob index file: " << fileName << std::endl;
+		return false;
+	}
+
+	m_Entries.resize(header.entryCount);
+	if (!in.read(reinterpret_cast<char *>(m_Entries.data()), header.entryCount * sizeof(BlobIndexEntry)))
+	{
+		std::cerr << "ERROR: truncated blob index file: " << fileName << std::endl;
+		clear();
+		return false;
+	}
+
+	// build() lists the blobs back to back from the start position up to the end of the file
+	uint64_t position = header.startPosition;
+	for (const BlobIndexEntry & entry : m_Entries)
+	{
+		if (entry.offset != position || entry.endOffset() > header.fileSize)
+			break;
+
+		position = entry.endOffset();
+	}
+
+	if (position != header.fileSize)
+	{
+		std::cerr << "ERROR: inconsistent blob offsets in blob index file: " << fileName << std::endl;
+		clear();
+		return false;
+	}
+
+	m_FileSize = header.fileSize;
+	m_StartPosition = header.startPosition;
+	m_PrimitiveInfo = header.primitiveInfo;
+
+	return true;
+}
+
+bool BlobIndex::save(const std::string & fileName) const
+{
+	std::ofstream out(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		std::cerr << "ERROR: could not create blob index file: " << fileName << std::endl;
+		return false;
+	}
+
+	IndexFileHeader header;
+	::memset(&header, 0, sizeof(IndexFileHeader));
+	::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	header.version = INDEX_VERSION;
+	header.byteOrderMark = INDEX_BYTE_ORDER_MARK;
+	header.fileSize = m_FileSize;
+	header.startPosition = m_StartPosition;
+	header.entrySize = sizeof(BlobIndexEntry);
+	header.primitiveInfo = m_PrimitiveInfo;
+	header.entryCount = m_Entries.size();
+
+	out.write(reinterpret_cast<const char *>(&header), sizeof(IndexFileHeader));
+	out.write(reinterpret_cast<const char *>(m_Entries.data()), m_Entries.size() * sizeof(BlobIndexEntry));
+
+	return out.good();
+}
+
+void BlobIndex::clear()
+{
+	m_Entries.clear();
+	m_FileSize = 0;
+	m_StartPosition = 0;
+	m_PrimitiveInfo = false;
+}
+
+SizeType BlobIndex::find(uint64_t position) const
+{
+	auto it = std::lower_bound(m_Entries.cbegin(), m_Entries.cend(), position,
+		[](const BlobIndexEntry & entry, uint64_t value) { return entry.offset < value; });
+
+	if (it == m_Entries.cend() || it->offset != position)
+		return size();
+
+	return it - m_Entries.cbegin();
+}
+
+bool BlobIndex::readPrimitiveInfo(const BlobFileIn & file, BlobIndexEntry & entry)
+{
+	entry.primitiveTypes = NoPrimitive;
+	entry.firstId = 0;
+	entry.lastId = 0;
+
+	thread_local BlobDataBuffer buffer;
+	thread_local crosby::binary::PrimitiveBlock primitiveBlock;
+
+	if (file.readBlobAt(entry.offset, buffer) != BLOB_OSMData || !primitiveBlock.ParseFromArray(buffer.data, buffer.availableBytes))
+		return false;
+
+	for (int i = 0; i < primitiveBlock.primitivegroup_size(); ++i)
+		updatePrimitiveInfo(primitiveBlock.primitivegroup(i), entry);
+
+	return true;
+}
+
+std::string BlobIndex::sidecarFileName(const std::string & fileName)
+{
+	return fileName + ".blobidx";
+}
+
+} // namespace osmpbf
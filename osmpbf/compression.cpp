@@ -0,0 +1,579 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#include "compression.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+// zlib-ng's native API refuses to be mixed with zlib.h, it handles deflate as well then
+#if defined(OSMPBF_INFLATE_ZLIB_NG)
+	#include <zlib-ng.h>
+	typedef zng_stream ZStream;
+	#define OSMPBF_Z(function) zng_##function
+#else
+	#include <zlib.h>
+	typedef z_stream ZStream;
+	#define OSMPBF_Z(function) function
+#endif
+
+#if defined(OSMPBF_INFLATE_LIBDEFLATE)
+	#include <libdeflate.h>
+#endif
+
+#if defined(OSMPBF_WITH_LZMA)
+	#include <lzma.h>
+#endif
+
+#if defined(OSMPBF_WITH_LZ4)
+	#include <lz4.h>
+#endif
+
+#if defined(OSMPBF_WITH_ZSTD)
+	#include <zstd.h>
+#endif
+
+namespace osmpbf
+{
+
+namespace
+{
+
+#if defined(OSMPBF_INFLATE_LIBDEFLATE)
+
+/// one decompressor per thread, libdeflate keeps no state between calls
+class InflateState
+{
+public:
+	InflateState() : m_Decompressor(libdeflate_alloc_decompressor()) {}
+	~InflateState() { if (m_Decompressor) libdeflate_free_decompressor(m_Decompressor); }
+
+	bool decompress(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+	{
+		if (!m_Decompressor)
+		{
+			std::cerr << "ERROR: libdeflate - could not allocate decompressor" << std::endl;
+			return false;
+		}
+
+		// without actual size libdeflate fails unless the output fills @dest exactly
+		switch (libdeflate_zlib_decompress(m_Decompressor, source, sourceSize, dest, destSize, NULL))
+		{
+		case LIBDEFLATE_SUCCESS:
+			return true;
+		case LIBDEFLATE_SHORT_OUTPUT:
+			std::cerr << "ERROR: libdeflate - raw size too large" << std::endl;
+			return false;
+		case LIBDEFLATE_INSUFFICIENT_SPACE:
+			std::cerr << "ERROR: libdeflate - raw size too small" << std::endl;
+			return false;
+		default:
+			std::cerr << "ERROR: libdeflate - bad data" << std::endl;
+			return false;
+		}
+	}
+
+private:
+	libdeflate_decompressor * m_Decompressor;
+};
+
+#else
+
+/// inflate stream per thread, reset instead of reallocating the window for every blob
+class InflateState
+{
+public:
+	InflateState()
+	{
+		m_Stream.zalloc = Z_NULL;
+		m_Stream.zfree = Z_NULL;
+		m_Stream.opaque = Z_NULL;
+		m_Stream.avail_in = 0;
+		m_Stream.next_in = Z_NULL;
+
+		m_Initialized = OSMPBF_Z(inflateInit)(&m_Stream) == Z_OK;
+	}
+
+	~InflateState()
+	{
+		if (m_Initialized)
+			OSMPBF_Z(inflateEnd)(&m_Stream);
+	}
+
+	bool decompress(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+	{
+		if (!m_Initialized || OSMPBF_Z(inflateReset)(&m_Stream) != Z_OK)
+		{
+			std::cerr << "ERROR: zlib - could not initialize stream" << std::endl;
+			return false;
+		}
+
+		m_Stream.avail_in = sourceSize;
+		m_Stream.next_in = (unsigned char *)source;
+		m_Stream.avail_out = destSize;
+		m_Stream.next_out = (unsigned char *)dest;
+
+		int ret = OSMPBF_Z(inflate)(&m_Stream, Z_FINISH);
+
+		assert(ret != Z_STREAM_ERROR);
+
+		switch (ret)
+		{
+		case Z_NEED_DICT:
+			std::cerr << "ERROR: zlib - Z_NEED_DICT" << std::endl;
+			return false;
+		case Z_DATA_ERROR:
+			std::cerr << "ERROR: zlib - Z_DATA_ERROR" << std::endl;
+			return false;
+		case Z_MEM_ERROR:
+			std::cerr << "ERROR: zlib - Z_MEM_ERROR" << std::endl;
+			return false;
+		case Z_STREAM_END:
+			if (m_Stream.avail_out)
+			{
+				std::cerr << "ERROR: zlib - raw size too large" << std::endl;
+				return false;
+			}
+			return true;
+		default:
+			// Z_BUF_ERROR or Z_OK: the output did not fit into raw size bytes or the input was truncated
+			std::cerr << "ERROR: zlib - raw size too small or truncated data" << std::endl;
+			return false;
+		}
+	}
+
+	uint32_t decompressPrefix(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+	{
+		if (!m_Initialized || OSMPBF_Z(inflateReset)(&m_Stream) != Z_OK)
+			return 0;
+
+		m_Stream.avail_in = sourceSize;
+		m_Stream.next_in = (unsigned char *)source;
+		m_Stream.avail_out = destSize;
+		m_Stream.next_out = (unsigned char *)dest;
+
+		int ret = OSMPBF_Z(inflate)(&m_Stream, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			return 0;
+
+		return destSize - m_Stream.avail_out;
+	}
+
+private:
+	ZStream m_Stream;
+	bool m_Initialized;
+};
+
+#endif
+
+/// deflate stream per thread, only re-initialized if the level changes
+class DeflateState
+{
+public:
+	DeflateState() : m_Level(0), m_Initialized(false) {}
+
+	~DeflateState()
+	{
+		if (m_Initialized)
+			OSMPBF_Z(deflateEnd)(&m_Stream);
+	}
+
+	ZStream * stream(int level)
+	{
+		if (m_Initialized && m_Level == level)
+			return OSMPBF_Z(deflateReset)(&m_Stream) == Z_OK ? &m_Stream : nullptr;
+
+		if (m_Initialized)
+			OSMPBF_Z(deflateEnd)(&m_Stream);
+
+		m_Stream.zalloc = Z_NULL;
+		m_Stream.zfree = Z_NULL;
+		m_Stream.opaque = Z_NULL;
+
+		m_Initialized = OSMPBF_Z(deflateInit)(&m_Stream, level) == Z_OK;
+		m_Level = level;
+
+		return m_Initialized ? &m_Stream : nullptr;
+	}
+
+private:
+	ZStream m_Stream;
+	int m_Level;
+	bool m_Initialized;
+};
+
+thread_local DeflateState deflateState;
+
+/// grow @buffer to at least @size bytes, the contents are not preserved
+inline void reserveBuffer(char * & buffer, uint32_t & bufferSize, uint32_t size)
+{
+	if (bufferSize >= size)
+		return;
+
+	delete[] buffer;
+	buffer = new char[size];
+	bufferSize = size;
+}
+
+#if defined(OSMPBF_WITH_LZMA)
+
+bool decompressLzma(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	uint64_t memoryLimit = UINT64_MAX;
+	std::size_t sourcePosition = 0;
+	std::size_t destPosition = 0;
+
+	lzma_ret ret = lzma_stream_buffer_decode(&memoryLimit, 0, nullptr,
+		(const uint8_t *)source, &sourcePosition, sourceSize,
+		(uint8_t *)dest, &destPosition, destSize);
+
+	if (ret != LZMA_OK)
+	{
+		std::cerr << "ERROR: lzma - decoding failed (" << ret << ")" << std::endl;
+		return false;
+	}
+
+	if (destPosition != destSize)
+	{
+		std::cerr << "ERROR: lzma - raw size too large" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t compressLzma(const char * source, uint32_t sourceSize, int level, char *& dest, uint32_t & destSize)
+{
+	reserveBuffer(dest, destSize, (uint32_t) lzma_stream_buffer_bound(sourceSize));
+
+	uint32_t preset = level < 0 ? LZMA_PRESET_DEFAULT : std::min(level, 9);
+
+	std::size_t destPosition = 0;
+	lzma_ret ret = lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32, nullptr,
+		(const uint8_t *)source, sourceSize, (uint8_t *)dest, &destPosition, destSize);
+
+	if (ret != LZMA_OK)
+	{
+		std::cerr << "ERROR: lzma - encoding failed (" << ret << ")" << std::endl;
+		return 0;
+	}
+
+	return (uint32_t) destPosition;
+}
+
+#endif
+
+#if defined(OSMPBF_WITH_LZ4)
+
+bool decompressLz4(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	int ret = LZ4_decompress_safe(source, dest, (int)sourceSize, (int)destSize);
+	if (ret < 0)
+	{
+		std::cerr << "ERROR: lz4 - malformed input or raw size too small" << std::endl;
+		return false;
+	}
+
+	if (uint32_t(ret) != destSize)
+	{
+		std::cerr << "ERROR: lz4 - raw size too large" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t compressLz4(const char * source, uint32_t sourceSize, char *& dest, uint32_t & destSize)
+{
+	reserveBuffer(dest, destSize, (uint32_t) LZ4_compressBound((int)sourceSize));
+
+	int ret = LZ4_compress_default(source, dest, (int)sourceSize, (int)destSize);
+	if (ret <= 0)
+	{
+		std::cerr << "ERROR: lz4 - encoding failed" << std::endl;
+		return 0;
+	}
+
+	return (uint32_t) ret;
+}
+
+#endif
+
+#if defined(OSMPBF_WITH_ZSTD)
+
+/// zstd contexts are expensive to set up, keep one of each per thread
+class ZstdState
+{
+public:
+	ZstdState() : m_DContext(nullptr), m_CContext(nullptr) {}
+	~ZstdState()
+	{
+		ZSTD_freeDCtx(m_DContext);
+		ZSTD_freeCCtx(m_CContext);
+	}
+
+	ZSTD_DCtx * dContext() { if (!m_DContext) m_DContext = ZSTD_createDCtx(); return m_DContext; }
+	ZSTD_CCtx * cContext() { if (!m_CContext) m_CContext = ZSTD_createCCtx(); return m_CContext; }
+
+private:
+	ZSTD_DCtx * m_DContext;
+	ZSTD_CCtx * m_CContext;
+};
+
+thread_local ZstdState zstdState;
+
+bool decompressZstd(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	ZSTD_DCtx * context = zstdState.dContext();
+	if (!context)
+		return false;
+
+	std::size_t ret = ZSTD_decompressDCtx(context, dest, destSize, source, sourceSize);
+	if (ZSTD_isError(ret))
+	{
+		std::cerr << "ERROR: zstd - " << ZSTD_getErrorName(ret) << std::endl;
+		return false;
+	}
+
+	if (ret != destSize)
+	{
+		std::cerr << "ERROR: zstd - raw size too large" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+uint32_t compressZstd(const char * source, uint32_t sourceSize, int level, char *& dest, uint32_t & destSize)
+{
+	ZSTD_CCtx * context = zstdState.cContext();
+	if (!context)
+		return 0;
+
+	reserveBuffer(dest, destSize, (uint32_t) ZSTD_compressBound(sourceSize));
+
+	std::size_t ret = ZSTD_compressCCtx(context, dest, destSize, source, sourceSize, level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+	if (ZSTD_isError(ret))
+	{
+		std::cerr << "ERROR: zstd - " << ZSTD_getErrorName(ret) << std::endl;
+		return 0;
+	}
+
+	return (uint32_t) ret;
+}
+
+#endif
+
+thread_local InflateState inflateState;
+
+} // anonymous namespace
+
+bool inflateData(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	return inflateState.decompress(source, sourceSize, dest, destSize);
+}
+
+bool compressionSupported(BlobCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_None:
+	case COMPRESSION_Zlib:
+		return true;
+#if defined(OSMPBF_WITH_LZMA)
+	case COMPRESSION_Lzma:
+		return true;
+#endif
+#if defined(OSMPBF_WITH_LZ4)
+	case COMPRESSION_Lz4:
+		return true;
+#endif
+#if defined(OSMPBF_WITH_ZSTD)
+	case COMPRESSION_Zstd:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+const char * compressionName(BlobCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_None: return "none";
+	case COMPRESSION_Zlib: return "zlib";
+	case COMPRESSION_Lzma: return "lzma";
+	case COMPRESSION_Lz4: return "lz4";
+	case COMPRESSION_Zstd: return "zstd";
+	default: return "unknown";
+	}
+}
+
+bool decompressData(BlobCompression compression, const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	if (!compressionSupported(compression))
+	{
+		std::cerr << "ERROR: " << compressionName(compression) << " compressed blobs are not supported by this build" << std::endl;
+		return false;
+	}
+
+	switch (compression)
+	{
+	case COMPRESSION_None:
+		if (sourceSize != destSize)
+			return false;
+
+		memmove(dest, source, destSize);
+		return true;
+	case COMPRESSION_Zlib:
+		return inflateData(source, sourceSize, dest, destSize);
+#if defined(OSMPBF_WITH_LZMA)
+	case COMPRESSION_Lzma:
+		return decompressLzma(source, sourceSize, dest, destSize);
+#endif
+#if defined(OSMPBF_WITH_LZ4)
+	case COMPRESSION_Lz4:
+		return decompressLz4(source, sourceSize, dest, destSize);
+#endif
+#if defined(OSMPBF_WITH_ZSTD)
+	case COMPRESSION_Zstd:
+		return decompressZstd(source, sourceSize, dest, destSize);
+#endif
+	default:
+		return false;
+	}
+}
+
+uint32_t decompressPrefix(BlobCompression compression, const char * source, uint32_t sourceSize, char * dest, uint32_t destSize)
+{
+	switch (compression)
+	{
+	case COMPRESSION_None:
+		destSize = std::min(sourceSize, destSize);
+		memmove(dest, source, destSize);
+		return destSize;
+#if !defined(OSMPBF_INFLATE_LIBDEFLATE)
+	case COMPRESSION_Zlib:
+		return inflateState.decompressPrefix(source, sourceSize, dest, destSize);
+#endif
+#if defined(OSMPBF_WITH_LZ4)
+	case COMPRESSION_Lz4:
+	{
+		int result = LZ4_decompress_safe_partial(source, dest, (int)sourceSize, (int)destSize, (int)destSize);
+		return result > 0 ? uint32_t(result) : 0;
+	}
+#endif
+	default:
+		// libdeflate, lzma and zstd only decode complete blobs here
+		return 0;
+	}
+}
+
+bool prefixDecompressionSupported(BlobCompression compression)
+{
+	switch (compression)
+	{
+	case COMPRESSION_None:
+#if !defined(OSMPBF_INFLATE_LIBDEFLATE)
+	case COMPRESSION_Zlib:
+#endif
+#if defined(OSMPBF_WITH_LZ4)
+	case COMPRESSION_Lz4:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+uint32_t compressData(BlobCompression compression, int level, const char * source, uint32_t sourceSize, char *& dest, uint32_t & destSize)
+{
+	if (!compressionSupported(compression))
+	{
+		std::cerr << "ERROR: " << compressionName(compression) << " compression is not supported by this build" << std::endl;
+		return 0;
+	}
+
+	switch (compression)
+	{
+	case COMPRESSION_Zlib:
+		return deflateData(source, sourceSize, level, dest, destSize);
+#if defined(OSMPBF_WITH_LZMA)
+	case COMPRESSION_Lzma:
+		return compressLzma(source, sourceSize, level, dest, destSize);
+#endif
+#if defined(OSMPBF_WITH_LZ4)
+	case COMPRESSION_Lz4:
+		return compressLz4(source, sourceSize, dest, destSize);
+#endif
+#if defined(OSMPBF_WITH_ZSTD)
+	case COMPRESSION_Zstd:
+		return compressZstd(source, sourceSize, level, dest, destSize);
+#endif
+	default:
+		return 0;
+	}
+}
+
+uint32_t deflateData(const char * source, uint32_t sourceSize, int level, char *& dest, uint32_t & destSize)
+{
+	ZStream * stream = deflateState.stream(level < 0 ? Z_BEST_COMPRESSION : std::min(level, 9));
+	if (!stream)
+	{
+		std::cerr << "ERROR: zlib - could not initialize stream" << std::endl;
+		return 0;
+	}
+
+	//overvlow will result in error during stream decoding
+	reserveBuffer(dest, destSize, (uint32_t) OSMPBF_Z(deflateBound)(stream, sourceSize));
+
+	stream->avail_in = sourceSize;
+	stream->next_in = (unsigned char *)source;
+	stream->avail_out = destSize;
+	stream->next_out = (unsigned char *)dest;
+
+	int ret = OSMPBF_Z(deflate)(stream, Z_FINISH);
+
+	assert(ret != Z_STREAM_ERROR);
+
+	switch (ret)
+	{
+	case Z_NEED_DICT:
+		std::cerr << "ERROR: zlib - Z_NEED_DICT" << std::endl;
+		return 0;
+	case Z_DATA_ERROR:
+		std::cerr << "ERROR: zlib - Z_DATA_ERROR" << std::endl;
+		return 0;
+	case Z_MEM_ERROR:
+		std::cerr << "ERROR: zlib - Z_MEM_ERROR" << std::endl;
+		return 0;
+	case Z_STREAM_END:
+		//has to smaller than destSize (which is uint32_t)
+		return (uint32_t) stream->total_out;
+	default:
+		std::cerr << "ERROR: zlib - input not compressable" << std::endl;
+		return 0;
+	}
+}
+
+} // namespace osmpbf
@@ -0,0 +1,85 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_COMPRESSION_H
+#define OSMPBF_COMPRESSION_H
+
+#include <osmpbf/blobdata.h>
+
+#include <cstdint>
+
+// internal header, not installed
+
+namespace osmpbf
+{
+
+/**
+ * decompress the zlib stream @source into @dest
+ *
+ * The implementation is selected at build time (see OSMPBF_INFLATE_BACKEND),
+ * it is safe to call from multiple threads at once.
+ *
+ * @param destSize uncompressed size as announced by the blob (raw_size)
+ */
+bool inflateData(const char * source, uint32_t sourceSize, char * dest, uint32_t destSize);
+
+/**
+ * compress @source into @dest, thread-safe
+ *
+ * @param level 0-9, negative selects Z_BEST_COMPRESSION
+ * @param dest reused if @destSize is large enough for the worst case, reallocated otherwise
+ * @return compressed size or 0 on error
+ */
+uint32_t deflateData(const char * source, uint32_t sourceSize, int level, char *& dest, uint32_t & destSize);
+
+///@return true if @compression was compiled in
+bool compressionSupported(BlobCompression compression);
+const char * compressionName(BlobCompression compression);
+
+/**
+ * decompress @source encoded with @compression into @dest, thread-safe
+ *
+ * @param destSize uncompressed size as announced by the blob (raw_size)
+ */
+bool decompressData(BlobCompression compression, const char * source, uint32_t sourceSize, char * dest, uint32_t destSize);
+
+/**
+ * decompress only the first @destSize bytes of @source into @dest, thread-safe
+ * used to peek at the start of a blob without inflating all of it
+ *
+ * @return number of bytes written, 0 on errors or if @compression does not support partial decoding
+ */
+uint32_t decompressPrefix(BlobCompression compression, const char * source, uint32_t sourceSize, char * dest, uint32_t destSize);
+
+///@return true if decompressPrefix() decodes @compression, its @source may be cut off then as well
+bool prefixDecompressionSupported(BlobCompression compression);
+
+/**
+ * compress @source with @compression into @dest, thread-safe
+ *
+ * @param level codec specific level, negative selects the codec's default (lz4 ignores it)
+ * @param dest reused if @destSize is large enough for the worst case, reallocated otherwise
+ * @return compressed size or 0 on error
+ */
+uint32_t compressData(BlobCompression compression, int level, const char * source, uint32_t sourceSize, char *& dest, uint32_t & destSize);
+
+} // namespace osmpbf
+
+#endif // OSMPBF_COMPRESSION_H
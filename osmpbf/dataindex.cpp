@@ -21,6 +21,7 @@
 #include <osmpbf/dataindex.h>
 
 #include "osmformat.pb.h"
+#include "deltacoding.h"
 
 #include <cstddef>
 #include <iostream>
@@ -32,7 +33,12 @@ namespace osmpbf
 
 // DenseNodesData
 
-DenseNodesData::DenseNodesData(const DenseNodesData & other) : m_Group(other.m_Group), m_KeyValIndex(other.m_KeyValIndex) {}
+DenseNodesData::DenseNodesData(const DenseNodesData & other) :
+	m_Group(other.m_Group),
+	m_KeyValIndex(other.m_KeyValIndex),
+	m_DataUnpacked(other.m_DataUnpacked),
+	m_InfoUnpacked(other.m_InfoUnpacked)
+{}
 
 DenseNodesData::DenseNodesData(crosby::binary::PrimitiveGroup * denseNodesGroup, bool unpack)
 	: m_Group(denseNodesGroup)
@@ -45,6 +51,8 @@ DenseNodesData & DenseNodesData::operator=(const DenseNodesData & other)
 {
 	m_Group = other.m_Group;
 	m_KeyValIndex = other.m_KeyValIndex;
+	m_DataUnpacked = other.m_DataUnpacked;
+	m_InfoUnpacked = other.m_InfoUnpacked;
 
 	return *this;
 }
@@ -87,19 +95,53 @@ void DenseNodesData::unpackData()
 
 	m_DataUnpacked = true;
 
-	int64_t id  = m_Group->dense().id(0);
-	int64_t lat = m_Group->dense().lat(0);
-	int64_t lon = m_Group->dense().lon(0);
+	// the packed columns are contiguous, decode them in place
+	crosby::binary::DenseNodes * dense = m_Group->mutable_dense();
 
-	for (int i = 1; i < m_Group->dense().id_size(); i++) {
-		id  += m_Group->dense().id(i);
-		lat += m_Group->dense().lat(i);
-		lon += m_Group->dense().lon(i);
+	decodeDeltas(dense->mutable_id()->mutable_data(), dense->id_size());
+	decodeDeltas(dense->mutable_lat()->mutable_data(), dense->lat_size());
+	decodeDeltas(dense->mutable_lon()->mutable_data(), dense->lon_size());
+}
 
-		m_Group->mutable_dense()->mutable_id()->Set(i, id);
-		m_Group->mutable_dense()->mutable_lat()->Set(i, lat);
-		m_Group->mutable_dense()->mutable_lon()->Set(i, lon);
-	}
+void DenseNodesData::unpackInfo()
+{
+	if (!m_Group || m_InfoUnpacked)
+		return;
+
+	m_InfoUnpacked = true;
+
+	if (!m_Group->dense().has_denseinfo())
+		return;
+
+	// version is not delta coded
+	crosby::binary::DenseInfo * denseInfo = m_Group->mutable_dense()->mutable_denseinfo();
+
+	decodeDeltas(denseInfo->mutable_timestamp()->mutable_data(), denseInfo->timestamp_size());
+	decodeDeltas(denseInfo->mutable_changeset()->mutable_data(), denseInfo->changeset_size());
+	decodeDeltas(denseInfo->mutable_uid()->mutable_data(), denseInfo->uid_size());
+	decodeDeltas(denseInfo->mutable_user_sid()->mutable_data(), denseInfo->user_sid_size());
+}
+
+bool DenseNodesData::hasInfo() const
+{
+	return m_Group && m_Group->dense().has_denseinfo();
+}
+
+IInfo DenseNodesData::info(int index)
+{
+	if (!hasInfo())
+		return IInfo();
+
+	unpackInfo();
+
+	const crosby::binary::DenseInfo & denseInfo = m_Group->dense().denseinfo();
+
+	return IInfo(
+		index < denseInfo.version_size() ? denseInfo.version(index) : -1,
+		index < denseInfo.timestamp_size() ? int32_t(denseInfo.timestamp(index)) : -1,
+		index < denseInfo.changeset_size() ? denseInfo.changeset(index) : -1,
+		index < denseInfo.uid_size() ? denseInfo.uid(index) : -1,
+		index < denseInfo.user_sid_size() ? denseInfo.user_sid(index) : -1);
 }
 
 } // namespace osmpbf
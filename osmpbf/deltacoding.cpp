@@ -0,0 +1,139 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#include "deltacoding.h"
+
+#if (defined(__x86_64__) || defined(_M_X64)) && defined(__GNUC__)
+#define OSMPBF_DELTA_X86
+#include <immintrin.h>
+#endif
+
+namespace osmpbf
+{
+
+namespace
+{
+
+typedef void (*DecodeFunction)(int64_t * data, uint32_t count);
+
+///running sums of @data starting at @sum
+inline void decodeTail(int64_t * data, uint32_t count, int64_t sum)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		sum += data[i];
+		data[i] = sum;
+	}
+}
+
+#ifdef OSMPBF_DELTA_X86
+
+// SSE2 is part of x86-64, no runtime check needed
+void decodeSse2(int64_t * data, uint32_t count)
+{
+	__m128i carry = _mm_setzero_si128();
+
+	uint32_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+		x = _mm_add_epi64(x, _mm_slli_si128(x, 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_add_epi64(x, carry));
+
+		// add the broadcast upper lane, keeps the dependency between iterations at a single add
+		carry = _mm_add_epi64(carry, _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 2, 3, 2)));
+	}
+
+	decodeTail(data + i, count - i, i ? data[i - 1] : 0);
+}
+
+__attribute__((target("avx2")))
+void decodeAvx2(int64_t * data, uint32_t count)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i carry = zero;
+
+	uint32_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+
+		// x += x shifted by one lane, then by two lanes
+		__m256i shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+		x = _mm256_add_epi64(x, shifted);
+		shifted = _mm256_blend_epi32(_mm256_permute4x64_epi64(x, _MM_SHUFFLE(1, 0, 0, 0)), zero, 0x0F);
+		x = _mm256_add_epi64(x, shifted);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_add_epi64(x, carry));
+
+		// add the broadcast upper lane, keeps the dependency between iterations at a single add
+		carry = _mm256_add_epi64(carry, _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3)));
+	}
+
+	decodeTail(data + i, count - i, i ? data[i - 1] : 0);
+}
+
+#else
+
+void decodeScalar(int64_t * data, uint32_t count)
+{
+	decodeTail(data, count, 0);
+}
+
+#endif // OSMPBF_DELTA_X86
+
+DecodeFunction selectDecoder()
+{
+#ifdef OSMPBF_DELTA_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return decodeAvx2;
+
+	return decodeSse2;
+#else
+	return decodeScalar;
+#endif
+}
+
+DecodeFunction decoder()
+{
+	static const DecodeFunction result = selectDecoder();
+	return result;
+}
+
+} // anonymous namespace
+
+void decodeDeltas(int64_t * data, uint32_t count)
+{
+	decoder()(data, count);
+}
+
+void decodeDeltas(int32_t * data, uint32_t count)
+{
+	// unsigned arithmetic wraps like the encoder did
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		sum += uint32_t(data[i]);
+		data[i] = int32_t(sum);
+	}
+}
+
+} // namespace osmpbf
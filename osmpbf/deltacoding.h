@@ -0,0 +1,44 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_DELTACODING_H
+#define OSMPBF_DELTACODING_H
+
+#include <cstdint>
+
+// internal header, not installed
+
+namespace osmpbf
+{
+
+/**
+ * replace the delta coded values in @data by their running sums, in place
+ *
+ * The implementation is selected at runtime (AVX2 if the cpu supports it,
+ * SSE2 or scalar otherwise), it is safe to call from multiple threads at once.
+ */
+void decodeDeltas(int64_t * data, uint32_t count);
+
+///32 bit variant for the uid and user_sid columns of DenseInfo, scalar only
+void decodeDeltas(int32_t * data, uint32_t count);
+
+} // namespace osmpbf
+
+#endif // OSMPBF_DELTACODING_H
@@ -1,6 +1,7 @@
 #include <osmpbf/fileio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <errno.h>
 
 #ifdef _WIN32
 	#include <WinSock2.h>
@@ -66,6 +67,60 @@ int munmap(void * addr, SizeType len) {
 	return ::munmap(addr, len);
 }
 
+#ifndef _WIN32
+int madvise(void * addr, SizeType len, int advice) {
+	int r = MADV_NORMAL;
+	switch (advice) {
+	case IO_ADVICE_SEQUENTIAL: r = MADV_SEQUENTIAL; break;
+	case IO_ADVICE_RANDOM: r = MADV_RANDOM; break;
+	case IO_ADVICE_WILLNEED: r = MADV_WILLNEED; break;
+	case IO_ADVICE_DONTNEED: r = MADV_DONTNEED; break;
+	case IO_ADVICE_HUGEPAGE:
+#ifdef MADV_HUGEPAGE
+		r = MADV_HUGEPAGE; break;
+#else
+		return 0;
+#endif
+	default: break;
+	}
+	return ::madvise(addr, len, r);
+}
+
+int fadvise(int fd, uint64_t offset, uint64_t len, int advice) {
+#ifdef POSIX_FADV_NORMAL
+	int r = POSIX_FADV_NORMAL;
+	switch (advice) {
+	case IO_ADVICE_SEQUENTIAL: r = POSIX_FADV_SEQUENTIAL; break;
+	case IO_ADVICE_RANDOM: r = POSIX_FADV_RANDOM; break;
+	case IO_ADVICE_WILLNEED: r = POSIX_FADV_WILLNEED; break;
+	case IO_ADVICE_DONTNEED: r = POSIX_FADV_DONTNEED; break;
+	case IO_ADVICE_HUGEPAGE: return 0;
+	default: break;
+	}
+	return ::posix_fadvise(fd, offset, len, r);
+#else
+	(void) fd; (void) offset; (void) len; (void) advice;
+	return 0;
+#endif
+}
+
+SizeType pageSize() {
+	return SizeType(::sysconf(_SC_PAGESIZE));
+}
+#else
+int madvise(void *, SizeType, int) {
+	return 0;
+}
+
+int fadvise(int, uint64_t, uint64_t, int) {
+	return 0;
+}
+
+SizeType pageSize() {
+	return 4096;
+}
+#endif
+
 bool validMmapAddress(void* addr) {
 	return addr != MAP_FAILED;
 }
@@ -78,6 +133,14 @@ uint64_t fileSize(int fd) {
 	return 0;
 }
 
+bool isRegularFile(int fd) {
+	struct stat stFileInfo;
+	if (fstat(fd, &stFileInfo) == 0) {
+		return (stFileInfo.st_mode & S_IFMT) == S_IFREG;
+	}
+	return false;
+}
+
 } //end namespace common
 
 #ifndef _WIN32
@@ -104,10 +167,30 @@ SignedSizeType write(int fd, const void * buffer, SizeType count) {
 	return ::write(fd, buffer, count);
 }
 
+SignedSizeType read(int fd, void * buffer, SizeType count) {
+	SignedSizeType r;
+	do {
+		r = ::read(fd, buffer, count);
+	} while (r < 0 && errno == EINTR);
+	return r;
+}
+
+SignedSizeType pread(int fd, void * buffer, SizeType count, uint64_t offset) {
+	SignedSizeType r;
+	do {
+		r = ::pread(fd, buffer, count, offset);
+	} while (r < 0 && errno == EINTR);
+	return r;
+}
+
 using common::mmap;
 using common::munmap;
 using common::validMmapAddress;
 using common::fileSize;
+using common::isRegularFile;
+using common::madvise;
+using common::fadvise;
+using common::pageSize;
 
 }//end namespace lx
 
@@ -136,10 +219,35 @@ SignedSizeType write(int fd, const void * buffer, SizeType count) {
 	return _write(fd, buffer, count);
 }
 
+SignedSizeType read(int fd, void * buffer, SizeType count) {
+	return _read(fd, buffer, (unsigned int) count);
+}
+
+// no pread on windows, positional ReadFile() is safe for concurrent use of @fd
+// but moves the file pointer of synchronous handles
+SignedSizeType pread(int fd, void * buffer, SizeType count, uint64_t offset) {
+	HANDLE handle = (HANDLE) _get_osfhandle(fd);
+	if (handle == INVALID_HANDLE_VALUE)
+		return -1;
+
+	OVERLAPPED overlapped = {};
+	overlapped.Offset = DWORD(offset);
+	overlapped.OffsetHigh = DWORD(offset >> 32);
+
+	DWORD r = 0;
+	if (!ReadFile(handle, buffer, DWORD(count < 0x7fffffff ? count : 0x7fffffff), &r, &overlapped))
+		return GetLastError() == ERROR_HANDLE_EOF ? 0 : -1;
+	return r;
+}
+
 using common::mmap;
 using common::munmap;
 using common::validMmapAddress;
 using common::fileSize;
+using common::isRegularFile;
+using common::madvise;
+using common::fadvise;
+using common::pageSize;
 
 } //end namespace windows
 #endif
@@ -187,6 +295,30 @@ uint64_t fileSize(int fd) {
 	return MY_NAME_SPACE::fileSize(fd);
 }
 
+SignedSizeType read(int fd, void * buffer, SizeType count) {
+	return MY_NAME_SPACE::read(fd, buffer, count);
+}
+
+SignedSizeType pread(int fd, void * buffer, SizeType count, uint64_t offset) {
+	return MY_NAME_SPACE::pread(fd, buffer, count, offset);
+}
+
+bool isRegularFile(int fd) {
+	return MY_NAME_SPACE::isRegularFile(fd);
+}
+
+int madvise(void * addr, SizeType len, int advice) {
+	return MY_NAME_SPACE::madvise(addr, len, advice);
+}
+
+int fadvise(int fd, uint64_t offset, uint64_t len, int advice) {
+	return MY_NAME_SPACE::fadvise(fd, offset, len, advice);
+}
+
+SizeType pageSize() {
+	return MY_NAME_SPACE::pageSize();
+}
+
 #undef MY_NAME_SPACE
 
 }//end namespace
\ No newline at end of file
@@ -529,20 +529,7 @@ uint32_t KeyOnlyTagFilter::findId(const std::string & str)
 	if (!m_PBI || m_PBI->isNull())
 		return 0;
 
-	uint32_t id = 0;
-
-	uint32_t stringTableSize = m_PBI->stringTableSize();
-
-	for (id = 1; id < stringTableSize; ++id)
-	{
-		if (str == m_PBI->queryStringTable(id))
-			break;
-	}
-
-	if (id >= stringTableSize)
-		id = 0;
-
-	return id;
+	return m_PBI->findString(str);
 }
 
 AbstractTagFilter* KeyOnlyTagFilter::copy(AbstractTagFilter::CopyMap& copies) const
@@ -784,11 +771,12 @@ bool MultiKeyTagFilter::p_rebuildCache()
 		return false;
 	}
 		
-	for(int i(0), s(m_PBI->stringTableSize()); i < s; ++i)
+	for(const std::string & key : m_KeySet)
 	{
-		if (m_KeySet.count(m_PBI->queryStringTable(i)))
+		// string tables may contain a key more than once
+		for(int id = m_PBI->findString(key); id; id = m_PBI->findString(key, id))
 		{
-			m_IdSet.insert(i);
+			m_IdSet.insert(id);
 		}
 	}
 	return m_IdSet.size();
@@ -0,0 +1,103 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_BLOBBUFFERPOOL_H
+#define OSMPBF_BLOBBUFFERPOOL_H
+
+#include <osmpbf/blobdata.h>
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace osmpbf
+{
+
+/**
+ * Thread-safe pool of blob data memory, organized in power-of-two size classes with a lock each.
+ * Idle buffers are bounded per size class and in total, surplus buffers are freed on release.
+ * Pooled memory is allocated with new[], so any BlobDataBuffer memory can be released into it.
+ */
+class BlobBufferPool
+{
+public:
+	/**
+	 * @param maxBuffersPerClass maximum number of idle buffers kept per size class
+	 * @param maxBytes maximum total size of idle buffers kept
+	 */
+	explicit BlobBufferPool(uint32_t maxBuffersPerClass = 16, uint64_t maxBytes = uint64_t(256) << 20);
+	~BlobBufferPool();
+
+	/**
+	 * make @data hold at least @size bytes, the contents are not preserved
+	 * too small memory is returned to the pool and replaced by a pooled buffer or a new allocation
+	 */
+	void reserve(char * & data, uint32_t & capacity, uint32_t size);
+	inline void reserve(BlobDataBuffer & buffer, uint32_t size) { reserve(buffer.data, buffer.totalBytes, size); }
+
+	///return @data to the pool (or free it if the pool is full), @data is NULL afterwards
+	void release(char * & data, uint32_t & capacity);
+
+	///return the memory of @buffer to the pool, @buffer is empty afterwards
+	inline void release(BlobDataBuffer & buffer)
+	{
+		release(buffer.data, buffer.totalBytes);
+		buffer.availableBytes = 0;
+		buffer.type = BLOB_Invalid;
+	}
+
+	///free all idle buffers
+	void clear();
+
+	///total size of the idle buffers
+	inline uint64_t idleBytes() const { return m_IdleBytes; }
+
+	///pool used for decoded blob data by BlobFileIn and the parse helpers
+	static BlobBufferPool & global();
+
+private:
+	struct Buffer
+	{
+		char * data;
+		uint32_t capacity;
+	};
+
+	struct SizeClass
+	{
+		std::mutex lock;
+		std::vector<Buffer> buffers;
+	};
+
+	static const int SIZE_CLASS_COUNT = 32;
+
+	SizeClass m_Classes[SIZE_CLASS_COUNT];
+
+	uint32_t m_MaxBuffersPerClass;
+	uint64_t m_MaxBytes;
+	std::atomic<uint64_t> m_IdleBytes;
+
+	BlobBufferPool(const BlobBufferPool & other) = delete;
+	BlobBufferPool & operator=(const BlobBufferPool & other) = delete;
+};
+
+} // namespace osmpbf
+
+#endif // OSMPBF_BLOBBUFFERPOOL_H
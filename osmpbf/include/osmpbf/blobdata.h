@@ -27,6 +27,10 @@
 
 namespace osmpbf {
 	enum BlobDataType {BLOB_Invalid = 0, BLOB_OSMHeader = 1, BLOB_OSMData = 2};
+	///payload encodings of a blob, everything except None and Zlib is optional at build time
+	enum BlobCompression {COMPRESSION_None = 0, COMPRESSION_Zlib = 1, COMPRESSION_Lzma = 2, COMPRESSION_Lz4 = 3, COMPRESSION_Zstd = 4};
+	///expected access to the input file, passed to the kernel as madvise()/fadvise() hint
+	enum AccessPattern {ACCESS_Default = 0, ACCESS_Sequential = 1, ACCESS_Random = 2};
 
 	struct BlobDataBuffer {
 		BlobDataType type;
@@ -56,7 +60,7 @@ namespace osmpbf {
 
 		BlobDataBuffer(BlobDataBuffer && other) :
 			type(other.type), data(other.data),
-			availableBytes(other.availableBytes), totalBytes(other.availableBytes)
+			availableBytes(other.availableBytes), totalBytes(other.totalBytes)
 		{
 			other.type = BLOB_Invalid;
 			other.data = 0;
@@ -97,6 +101,27 @@ namespace osmpbf {
 			return *this;
 		}
 	};
+
+	/**
+	 * Payload of a serialized blob, referencing the source data instead of copying it.
+	 * Views returned by BlobFileIn::readBlobView() point into the mapped file and stay valid until it is closed.
+	 */
+	struct BlobView {
+		BlobDataType type;
+		///COMPRESSION_None for raw blobs
+		BlobCompression compression;
+		///raw or compressed payload
+		const char * data;
+		uint32_t dataSize;
+		///uncompressed size, equals dataSize for raw blobs
+		uint32_t rawSize;
+		///the blob declares its uncompressed size (raw_size), required for compressed blobs
+		bool hasRawSize;
+
+		inline bool isRaw() const { return data && compression == COMPRESSION_None; }
+
+		BlobView() : type(BLOB_Invalid), compression(COMPRESSION_None), data(NULL), dataSize(0), rawSize(0), hasRawSize(false) {}
+	};
 }
 
 #endif // OSMPBF_BLOBDATA_H
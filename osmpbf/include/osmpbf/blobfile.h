@@ -22,17 +22,33 @@
 #define OSMPBF_BLOBFILE_H
 
 #include <osmpbf/blobdata.h>
+#include <osmpbf/common.h>
 #include <osmpbf/typelimits.h>
 
 #include <mutex>
+#include <set>
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 
 namespace osmpbf
 {
 
+/**
+ * decode the serialized Blob message at @data without copying its payload
+ * @view references @data afterwards, its type is left untouched
+ * fails on truncated fields and on a raw_size not below the maximum blob size
+ */
+bool parseBlobView(const char * data, uint32_t length, BlobView & view);
+
+/**
+ * decompress the payload of @view (raw payloads are copied) into @buffer, reusing its memory
+ * thread-safe, @return false and sets @buffer type to BLOB_Invalid on failure
+ */
+bool decodeBlobView(const BlobView & view, BlobDataBuffer & buffer);
+
 class AbstractBlobFile
 {
 public:
@@ -52,6 +68,11 @@ public:
 		m_VerboseOutput = value;
 	}
 
+	inline const std::string & fileName() const
+	{
+		return m_FileName;
+	}
+
 protected:
 	AbstractBlobFile() = delete;
 
@@ -60,6 +81,8 @@ protected:
 	bool m_VerboseOutput;
 };
 
+class AsyncReader;
+
 class BlobFileIn : public AbstractBlobFile
 {
 public:
@@ -79,26 +102,324 @@ public:
 	///thread-safe
 	void readBlob(BlobDataBuffer & buffer);
 	///thread-safe
-	BlobDataType readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize);
+	virtual BlobDataType readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize);
+
+	/**
+	 * read the next blob without decoding or copying it, thread-safe
+	 * raw blobs can be parsed straight from view.data, others decoded with decodeBlobView()
+	 * only available if blobViewsAvailable()
+	 *
+	 * @return type of the blob, BLOB_Invalid on errors and at the end of the file
+	 */
+	BlobDataType readBlobView(BlobView & view);
+
+	///@return true if the file is mapped and not in pipeline mode
+	inline bool blobViewsAvailable() const { return m_FileData && !m_PipelineThreads; }
+
+	/**
+	 * Enable pipeline mode: a reader thread walks the blob headers while @threadCount decoder
+	 * threads decompress blobs straight out of the mapped file into pooled buffers.
+	 * readBlob() then hands out the decoded blobs in file order, swapping the passed buffer
+	 * into the pool.
+	 *
+	 * @param threadCount number of decoder threads, 0 disables pipeline mode
+	 * @param queueDepth maximum number of blobs decoded ahead, defaults to 2 * threadCount
+	 */
+	virtual void setPipelineMode(uint32_t threadCount, uint32_t queueDepth = 0);
+	inline bool pipelineMode() const { return m_PipelineThreads; }
+
+	/**
+	 * Hint the expected access pattern to the kernel, applies to the open file and later open() calls.
+	 * ACCESS_Sequential enlarges the kernel read-ahead and releases consumed file data behind the
+	 * read position from this process and the page cache, so a single pass over a large file
+	 * neither grows the resident set nor evicts the page cache of other processes.
+	 * ACCESS_Random disables read-ahead, e.g. for lookups through a BlobIndex.
+	 *
+	 * @param hugePages ask for transparent huge pages for the mapping, ignored where unsupported
+	 */
+	void setAccessPattern(AccessPattern pattern, bool hugePages = false);
+	inline AccessPattern accessPattern() const { return m_AccessPattern; }
+	inline bool hugePages() const { return m_HugePages; }
+
+	/**
+	 * Skip OSMData blobs containing none of the @wanted primitive types (combination of PrimitiveType).
+	 * In files sorted by type then id, blobs are classified by a partial decode of their first primitive
+	 * group and the one of the following blob, so unwanted blobs are not decompressed and reading stops
+	 * once no wanted type can follow. Other blobs are classified after decompression, which still saves
+	 * parsing them.
+	 *
+	 * @param sortedByType the file is sorted by type then id ("Sort.Type_then_ID")
+	 */
+	void setPrimitiveFilter(PrimitiveTypeFlags wanted, bool sortedByType = false);
+	inline PrimitiveTypeFlags wantedPrimitives() const { return m_WantedPrimitives; }
+
+	enum FilterAction { FILTER_Read, FILTER_Skip, FILTER_SkipRest };
+
+	/**
+	 * decide on the OSMData blob at @position by peeking at its first primitive type, thread-safe
+	 * only files sorted by type allow skipping, FILTER_SkipRest also covers all blobs behind it
+	 *
+	 * @param nextPosition position of the following blob, peeked if neccessary
+	 */
+	FilterAction peekFilterAction(uint64_t position, uint64_t nextPosition);
+
+	/**
+	 * type of the first primitive group of the OSMData blob at @position, thread-safe
+	 * only the start of the blob is decompressed if the codec allows it
+	 *
+	 * @return NoPrimitive if unknown
+	 */
+	virtual PrimitiveType peekPrimitiveType(uint64_t position) const;
+
+	///thread-safe, @return false if the decoded OSMData block @data contains only unwanted primitive types
+	bool wantedPrimitiveBlock(const char * data, uint32_t length) const;
 
 	///Only makes sense in single-thread usage
-	bool skipBlob();
+	virtual bool skipBlob();
+
+	///@return true if there are no more blobs to read
+	virtual bool atEnd();
+
+	/**
+	 * parse the blob header at @position without reading the blob data
+	 * thread-safe, does not change the current position
+	 *
+	 * @param headerSize size of the serialized BlobHeader (without the leading length field)
+	 * @param blobLength size of the serialized Blob following the header
+	 * @return false if there is no valid blob header at @position
+	 */
+	virtual bool readBlobHeader(uint64_t position, uint32_t & headerSize, uint32_t & blobLength, BlobDataType & blobDataType) const;
+
+	/**
+	 * read and decode the blob at @position, the primitive filter is not applied
+	 * thread-safe, does not change the current position
+	 * missing or too small memory of @buffer is taken from BlobBufferPool::global()
+	 */
+	virtual BlobDataType readBlobAt(uint64_t position, BlobDataBuffer & buffer) const;
+
+	/**
+	 * stop reading at the first blob starting at or behind @position, size() removes the limit
+	 * reset by open(), see OSMFileIn::setShard()
+	 */
+	void setReadLimit(uint64_t position);
+	inline uint64_t readLimit() const { return m_ReadLimit; }
+
+	/**
+	 * position of the first blob starting at or behind @position, size() if there is none
+	 * Resynchronizes from arbitrary offsets by probing for a BlobHeader which is followed by another
+	 * one or the end of the file. Thread-safe, does not change the current position.
+	 */
+	uint64_t findBlobStart(uint64_t position) const;
 
 protected:
+	class Pipeline;
+
 	char * m_FileData;
 	std::mutex m_fileLock;
 	SizeType m_FilePos;
-	SizeType m_FileSize;
+	///64 bit even on 32 bit platforms, streams are not limited by the address space
+	uint64_t m_FileSize;
+	///blobs starting at or behind this position are not read
+	uint64_t m_ReadLimit;
+
+	Pipeline * m_Pipeline;
+	uint32_t m_PipelineThreads;
+	uint32_t m_PipelineDepth;
+
+	AccessPattern m_AccessPattern;
+	bool m_HugePages;
+	///file data below this (page aligned) position has been released
+	uint64_t m_ReleasedPos;
+	///start of the blobs still decoded by concurrent readBlob() calls, guarded by m_fileLock
+	std::multiset<uint64_t> m_DecodingPositions;
+
+	PrimitiveTypeFlags m_WantedPrimitives;
+	bool m_SortedByType;
+	///last blob peeked by sortedFilterAction(), guarded by m_fileLock
+	uint64_t m_PeekPosition;
+	PrimitiveType m_PeekType;
+
+	inline bool primitiveFilterActive() const { return (m_WantedPrimitives & AllPrimitives) != AllPrimitives; }
+
+	/**
+	 * decide on a blob of a sorted file by its first primitive type, has to be guarded by m_fileLock
+	 * @param nextPosition position of the following blob, peeked if neccessary
+	 */
+	FilterAction sortedFilterAction(PrimitiveType first, uint64_t nextPosition);
+	/**
+	 * peekPrimitiveType() with a cache of the last result, has to be guarded by m_fileLock
+	 * @param blobData serialized Blob at @position if already in memory, it is peeked instead of the file
+	 */
+	PrimitiveType peekPrimitiveTypeCached(uint64_t position, const char * blobData = NULL, uint32_t blobLength = 0);
+
+	/**
+	 * decide on the blob at @position by the primitive filter, has to be guarded by m_fileLock
+	 * FILTER_Read unless it is an OSMData blob of a file sorted by type and a filter is set
+	 *
+	 * @param nextPosition position of the following blob, peeked if neccessary
+	 * @param blobData serialized Blob at @position if already in memory
+	 */
+	FilterAction filterAction(BlobDataType blobDataType, uint64_t position, uint64_t nextPosition,
+		const char * blobData = NULL, uint32_t blobLength = 0);
+
+	///thread-safe, type of the first primitive group of the serialized Blob at @blobData
+	PrimitiveType peekBlobPrimitiveType(const char * blobData, uint32_t blobLength) const;
 
 	void readBlobHeader(uint32_t & blobLength, BlobDataType & blobDataType);
 
+	///thread-safe, parses the serialized BlobHeader at @data
+	bool parseBlobHeader(const char * data, uint32_t headerLength, uint32_t & blobLength, BlobDataType & blobDataType) const;
+
+	///thread-safe, decodes the serialized Blob at @blobData and decompresses its payload into @buffer
+	BlobDataType decodeBlob(const char * blobData, uint32_t blobLength, BlobDataType blobDataType,
+		char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize) const;
+
+	void stopPipeline();
+
+	///pass the access pattern hints for the open file to the kernel
+	void applyAccessPattern();
+	///release file data in front of @position (ACCESS_Sequential only), has to be guarded by m_fileLock
+	void releaseConsumed(uint64_t position);
+	///restart releasing at @position after seeking, has to be guarded by m_fileLock
+	void resetReleasedPosition(uint64_t position);
+
 	void * fileData();
-	void * fileData(SizeType _position);
+	void * fileData(SizeType _position) const;
+
+	///@length bytes of the file at @position, copied into @scratch if neccessary, NULL on errors
+	virtual const char * readDataAt(uint64_t position, SizeType length, std::vector<char> & scratch) const;
 
 private:
 	BlobFileIn() = delete;
 };
 
+/**
+ * BlobFileIn reading with read()/pread() into a reusable buffer instead of mapping the whole file.
+ * Works on pipes and stdin (file name "-") and its memory use does not depend on the file size.
+ *
+ * readBlob() keeps its thread-safety contract: raw blobs are read into pooled buffers while
+ * holding the file lock and decoded outside of it, so concurrent callers still decode in parallel.
+ * Pipeline mode is not available. Seeking backwards and random access (readBlobHeader(position),
+ * BlobIndex) require a regular file.
+ */
+class BlobStreamIn : public BlobFileIn
+{
+public:
+	/**
+	 * @param fileName file to read, "-" reads from stdin
+	 * @param readBufferSize size of the read buffer, larger blobs are read directly into their target buffer
+	 */
+	explicit BlobStreamIn(const std::string & fileName, uint32_t readBufferSize = 1 << 20);
+	virtual ~BlobStreamIn();
+
+	virtual bool open() override;
+	virtual void close() override;
+
+	///Only makes sense in single-thread usage, only forward seeking on non-regular files
+	virtual void seek(OffsetType position) override;
+	///Only makes sense in single-thread usage, truncated on 32 bit platforms, see streamPosition()
+	virtual SizeType position() const override;
+
+	///file size for regular files, number of bytes read so far otherwise, truncated on 32 bit platforms
+	virtual SizeType size() const override;
+
+	///seek() with 64 bit positions, streams may exceed the address space of 32 bit platforms
+	void seekStream(uint64_t position);
+	///position() in 64 bit
+	uint64_t streamPosition() const;
+	///size() in 64 bit
+	uint64_t streamSize() const;
+
+	///pipeline mode is not available for streams, use setReadAhead()
+	virtual void setPipelineMode(uint32_t threadCount, uint32_t queueDepth = 0) override;
+
+	using BlobFileIn::readBlob;
+	///thread-safe
+	virtual BlobDataType readBlob(char * & buffer, uint32_t & bufferSize, uint32_t & availableDataSize) override;
+
+	///Only makes sense in single-thread usage
+	virtual bool skipBlob() override;
+
+	virtual bool atEnd() override;
+
+	///thread-safe, fails on non-regular files
+	virtual bool readBlobHeader(uint64_t position, uint32_t & headerSize, uint32_t & blobLength, BlobDataType & blobDataType) const override;
+
+	///thread-safe, NoPrimitive on non-regular files
+	virtual PrimitiveType peekPrimitiveType(uint64_t position) const override;
+
+	///thread-safe, fails on non-regular files
+	virtual BlobDataType readBlobAt(uint64_t position, BlobDataBuffer & buffer) const override;
+
+	///@return true if the input is a regular file which supports seeking and random access
+	inline bool seekable() const { return m_Seekable; }
+
+	/**
+	 * Read regular files ahead with up to @queueDepth chunks of readBufferSize in flight.
+	 * Reads are issued through io_uring if the kernel allows it (Linux), otherwise with pread().
+	 * Keeps consumers from stalling on page faults while holding the file lock.
+	 *
+	 * @param queueDepth number of chunks read ahead, 0 disables read-ahead
+	 */
+	void setReadAhead(uint32_t queueDepth);
+	inline uint32_t readAhead() const { return m_ReadAheadDepth; }
+
+	///@return true if read-ahead is active and uses io_uring
+	bool ioUringActive() const;
+
+protected:
+	struct RawBuffer
+	{
+		char * data;
+		uint32_t size;
+	};
+
+	char * m_ReadBuffer;
+	///current chunk, either m_ReadBuffer or a read-ahead chunk
+	const char * m_ReadData;
+	uint32_t m_ReadBufferSize;
+	uint32_t m_ReadBegin;
+	uint32_t m_ReadEnd;
+
+	///stream offset of the first unconsumed byte
+	uint64_t m_StreamPos;
+
+	bool m_Seekable;
+	bool m_EndOfStream;
+	bool m_OwnsDescriptor;
+
+	std::vector<char> m_HeaderBuffer;
+
+	std::mutex m_RawBuffersLock;
+	std::vector<RawBuffer> m_RawBuffers;
+
+	AsyncReader * m_AsyncReader;
+	uint32_t m_ReadAheadDepth;
+
+	///read blob length and header, has to be guarded by m_fileLock
+	bool readStreamBlobHeader(uint32_t & blobLength, BlobDataType & blobDataType);
+
+	///read exactly @count bytes, has to be guarded by m_fileLock
+	bool readBytes(char * dest, uint32_t count);
+	///discard @count bytes, has to be guarded by m_fileLock
+	bool skipBytes(uint64_t count);
+	///refill the consumed read buffer, @return false at the end of the stream
+	bool fillReadBuffer();
+	///drop buffered data and continue reading at m_StreamPos (seekable files only)
+	void resetReadPosition();
+	///read up to @count bytes behind the consumed read buffer, has to be guarded by m_fileLock
+	SignedSizeType readInput(char * dest, uint32_t count);
+
+	RawBuffer acquireRawBuffer(uint32_t size);
+	void releaseRawBuffer(const RawBuffer & buffer);
+
+	///pread() into @scratch, regular files only
+	virtual const char * readDataAt(uint64_t position, SizeType length, std::vector<char> & scratch) const override;
+
+private:
+	BlobStreamIn() = delete;
+};
+
 class BlobFileOut : public AbstractBlobFile
 {
 public:
@@ -113,11 +434,64 @@ public:
 
 	virtual SizeType size() const override;
 
+	/**
+	 * codec used by writeBlob(..., compress = true), defaults to COMPRESSION_Zlib
+	 * readers without lzma/lz4/zstd support (most tools) can only read zlib files
+	 *
+	 * @return false if @compression was not compiled in, the previous setting is kept then
+	 */
+	bool setCompression(BlobCompression compression);
+	inline BlobCompression compression() const { return m_Compression; }
+
+	static bool isCompressionSupported(BlobCompression compression);
+
+	///codec specific level (zlib/lzma 0-9, zstd 1-22), negative selects the default (zlib: 9)
+	void setCompressionLevel(int level);
+	inline int compressionLevel() const { return m_CompressionLevel; }
+
+	/**
+	 * Compress blobs on @threadCount worker threads. writeBlob() then queues a copy of
+	 * the data and returns, the blobs are still written in submission order.
+	 * A failed queued blob makes later writeBlob() calls return false until flush() reports
+	 * and clears the failure, close() prints it if it was not reported yet.
+	 *
+	 * @param threadCount number of compression threads, 0 compresses on the calling thread
+	 * @param queueDepth maximum number of queued blobs, defaults to 2 * threadCount
+	 */
+	void setCompressionThreads(uint32_t threadCount, uint32_t queueDepth = 0);
+	inline uint32_t compressionThreads() const { return m_CompressorThreads; }
+
+	///wait until all queued blobs are written, @return false if any of them failed
+	bool flush();
+
 	bool writeBlob(const BlobDataBuffer & buffer, bool compress = true);
 	bool writeBlob(BlobDataType type, const char * buffer, uint32_t bufferSize, bool compress = true);
 
 protected:
+	class Compressor;
+
 	SizeType m_CurrentSize;
+	BlobCompression m_Compression;
+	int m_CompressionLevel;
+
+	Compressor * m_Compressor;
+	uint32_t m_CompressorThreads;
+	uint32_t m_CompressorDepth;
+	///failure of blobs queued to a stopped compressor, not reported by flush() yet
+	bool m_WriteFailed;
+
+	// buffers reused by writeBlob() when compressing on the calling thread
+	char * m_CompressBuffer;
+	uint32_t m_CompressBufferSize;
+	std::string m_BlockBuffer;
+
+	///thread-safe, compresses the data if requested and serializes the complete file block into @block
+	bool encodeBlob(BlobDataType type, const char * buffer, uint32_t bufferSize, bool compress,
+		BlobCompression compression, int level, char * & compressBuffer, uint32_t & compressBufferSize, std::string & block) const;
+	///writes @block at the current position
+	bool writeBlock(const std::string & block);
+
+	void stopCompressor();
 
 private:
 	BlobFileOut() = delete;
@@ -0,0 +1,116 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_BLOBINDEX_H
+#define OSMPBF_BLOBINDEX_H
+
+#include <osmpbf/blobdata.h>
+#include <osmpbf/common.h>
+#include <osmpbf/typelimits.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace osmpbf
+{
+
+class BlobFileIn;
+
+struct BlobIndexEntry
+{
+	///position of the blob header length field within the file
+	uint64_t offset;
+	///size of the serialized BlobHeader
+	uint32_t headerSize;
+	///size of the serialized Blob
+	uint32_t dataSize;
+
+	///first and last primitive id, only valid if primitiveTypes != NoPrimitive
+	int64_t firstId;
+	int64_t lastId;
+
+	BlobDataType type;
+	///combination of PrimitiveType found in the blob, NoPrimitive if unknown
+	PrimitiveTypeFlags primitiveTypes;
+	uint16_t reserved;
+
+	inline uint64_t dataOffset() const { return offset + 4 + headerSize; }
+	inline uint64_t endOffset() const { return dataOffset() + dataSize; }
+};
+
+/**
+ * Offsets, sizes and (optionally) primitive id ranges of all blobs of a file.
+ * Can be built with a single pass over the blob headers and stored next to the file.
+ */
+class BlobIndex
+{
+public:
+	BlobIndex();
+
+	/**
+	 * build the index by walking the blob headers starting at @startPosition
+	 * the current position of @file is not changed
+	 *
+	 * @param primitiveInfo also decode each data blob to record its primitive types and id range
+	 */
+	bool build(BlobFileIn & file, SizeType startPosition = 0, bool primitiveInfo = false);
+
+	///load index from @fileName, fails on missing, corrupt or foreign index files
+	bool load(const std::string & fileName);
+	bool save(const std::string & fileName) const;
+
+	void clear();
+
+	inline bool empty() const { return m_Entries.empty(); }
+	inline SizeType size() const { return m_Entries.size(); }
+
+	inline const BlobIndexEntry & at(SizeType n) const { return m_Entries[n]; }
+	inline const BlobIndexEntry & operator[](SizeType n) const { return m_Entries[n]; }
+
+	inline const std::vector<BlobIndexEntry> & entries() const { return m_Entries; }
+
+	///size of the indexed file, used to detect stale index files
+	inline uint64_t fileSize() const { return m_FileSize; }
+	inline uint64_t startPosition() const { return m_StartPosition; }
+	inline bool hasPrimitiveInfo() const { return m_PrimitiveInfo; }
+
+	///@return index of the blob starting at @position or size() if there is none
+	SizeType find(uint64_t position) const;
+
+	/**
+	 * decode the blob at @entry.offset to record its primitive types and id range in @entry
+	 * thread-safe if @file is, the current position of @file is not changed
+	 */
+	static bool readPrimitiveInfo(const BlobFileIn & file, BlobIndexEntry & entry);
+
+	///default name of the index file stored next to @fileName
+	static std::string sidecarFileName(const std::string & fileName);
+
+private:
+	std::vector<BlobIndexEntry> m_Entries;
+	uint64_t m_FileSize;
+	uint64_t m_StartPosition;
+	bool m_PrimitiveInfo;
+};
+
+} // namespace osmpbf
+
+#endif // OSMPBF_BLOBINDEX_H
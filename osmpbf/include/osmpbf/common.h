@@ -49,7 +49,9 @@ enum PrimitiveType : PrimitiveTypeFlags
 
 	NodePrimitive = 0x1,
 	WayPrimitive = 0x2,
-	RelationPrimitive = 0x4
+	RelationPrimitive = 0x4,
+
+	AllPrimitives = NodePrimitive | WayPrimitive | RelationPrimitive
 };
 
 } // namespace osmpbf
@@ -22,6 +22,7 @@
 #define NODEDATACACHE_H
 
 #include <osmpbf/pbf_prototypes.h>
+#include <osmpbf/iinfo.h>
 
 #include <vector>
 
@@ -42,6 +43,7 @@ public:
 
 	inline crosby::binary::PrimitiveGroup * group() { return m_Group; }
 	inline bool isDataUnpacked() const { return m_DataUnpacked; }
+	inline bool isInfoUnpacked() const { return m_InfoUnpacked; }
 
 	inline int queryDenseNodeKeyValIndex(int index)
 	{
@@ -53,12 +55,20 @@ public:
 
 	void unpackData();
 
+	///decode the delta coded DenseInfo columns in place, done by info() on first use
+	void unpackInfo();
+
+	bool hasInfo() const;
+	///metadata of the node at @index, fields missing in the DenseInfo are -1
+	IInfo info(int index);
+
 private:
 	void buildDenseNodeKeyValIndex();
 
 	crosby::binary::PrimitiveGroup * m_Group;
 	std::vector<int> m_KeyValIndex;
 	bool m_DataUnpacked = false;
+	bool m_InfoUnpacked = false;
 };
 
 typedef std::vector<crosby::binary::PrimitiveGroup *> PrimitiveGroupVector;
@@ -11,6 +11,7 @@ typedef enum { IO_OPEN_READ_ONLY=00, IO_OPEN_WRITE_ONLY=01, IO_OPEN_CREATE=0100,
 typedef enum { IO_SEEK_SET=0x0, IO_SEEK_CUR=0x1 } IoSeekOptions;
 typedef enum { MM_PROT_READ=0x1 } MmapProtections;
 typedef enum { MM_MAP_SHARED=0x1 } MmapSharing;
+typedef enum { IO_ADVICE_NORMAL, IO_ADVICE_SEQUENTIAL, IO_ADVICE_RANDOM, IO_ADVICE_WILLNEED, IO_ADVICE_DONTNEED, IO_ADVICE_HUGEPAGE } IoAdvice;
 
 ///@param oflag combination of IoOpenFlags
 int open(const char * path, int oflag);
@@ -24,6 +25,16 @@ SignedSizeType lseek(int fd, osmpbf::OffsetType offset, int whence);
 
 SignedSizeType write(int fd, const void * buffer, SizeType count);
 
+///retries if interrupted by a signal
+SignedSizeType read(int fd, void * buffer, SizeType count);
+
+///read at @offset, thread-safe, retries if interrupted by a signal
+///the file position is not moved on POSIX systems, but may be on Windows
+SignedSizeType pread(int fd, void * buffer, SizeType count, uint64_t offset);
+
+///@return true if @fd refers to a regular file (as opposed to a pipe, socket or terminal)
+bool isRegularFile(int fd);
+
 ///@param protection expects a combination of MmapProtections
 ///@param flags expects a combination of MmapSharing
 void * mmap (void * addr, SizeType len, int protection, int flags, int fd, OffsetType offset);
@@ -32,6 +43,14 @@ bool validMmapAddress(void * addr);
 
 int munmap(void * addr, SizeType len);
 
+///@param advice one of IoAdvice, @addr has to be page aligned, no-op where unsupported
+int madvise(void * addr, SizeType len, int advice);
+
+///@param advice one of IoAdvice (except IO_ADVICE_HUGEPAGE), no-op where unsupported
+int fadvise(int fd, uint64_t offset, uint64_t len, int advice);
+
+SizeType pageSize();
+
 uint64_t fileSize(int fd);
 
 }//end namespace osmpbf
@@ -8,6 +8,8 @@ namespace osmpbf {
 class IInfo {
 public:
 	IInfo() : m_version(-1), m_timestamp(-1), m_changeset(-1), m_userId(-1), m_userStringId(-1) {}
+	IInfo(int32_t version, int32_t timestamp, int64_t changeset, int32_t userId, int32_t userStringId) :
+		m_version(version), m_timestamp(timestamp), m_changeset(changeset), m_userId(userId), m_userStringId(userStringId) {}
 	IInfo(const ::crosby::binary::Info & info);
 	inline int32_t version() const { return m_version; }
 	inline int32_t timestamp() const { return m_timestamp; }
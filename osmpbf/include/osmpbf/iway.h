@@ -50,6 +50,9 @@ public:
 	inline int64_t rawRef(int index) const { return static_cast< WayInputAdaptor * >(m_Private)->rawRef(index); }
 	inline int refsSize() const { return static_cast< WayInputAdaptor * >(m_Private)->refsSize(); }
 
+	///decode all refsSize() node refs into @dest
+	inline void decodeRefs(int64_t * dest) const { static_cast< WayInputAdaptor * >(m_Private)->decodeRefs(dest); }
+
 	inline RefIterator refBegin() const { return static_cast< WayInputAdaptor * >(m_Private)->refBegin(); }
 	inline RefIterator refEnd() const { return static_cast< WayInputAdaptor * >(m_Private)->refEnd(); }
 
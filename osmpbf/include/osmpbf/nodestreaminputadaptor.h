@@ -35,6 +35,8 @@ class NodeStreamInputAdaptor : public AbstractNodeInputAdaptor
 public:
 	NodeStreamInputAdaptor();
 	NodeStreamInputAdaptor(PrimitiveBlockInputAdaptor * controller);
+	///start at the node at @position instead of the first one, see PrimitiveBlockInputAdaptor::getNodeAt()
+	NodeStreamInputAdaptor(PrimitiveBlockInputAdaptor * controller, int position);
 
 	virtual bool isNull() const override;
 
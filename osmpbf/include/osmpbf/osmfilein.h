@@ -22,6 +22,7 @@
 #define OSMPBF_OSMFILEIN_H
 
 #include <osmpbf/blobdata.h>
+#include <osmpbf/common.h>
 #include <osmpbf/typelimits.h>
 #include <osmpbf/pbf_prototypes.h>
 
@@ -33,6 +34,8 @@ namespace osmpbf
 
 class PrimitiveBlockInputAdaptor;
 class BlobFileIn;
+class BlobIndex;
+struct BlobIndexEntry;
 
 typedef std::vector<BlobDataBuffer> BlobDataMultiBuffer;
 
@@ -54,6 +57,33 @@ public:
 
 	SizeType totalSize() const;
 
+	/**
+	 * decode blobs ahead of time with @threadCount decoder threads, blocks are still delivered in file order
+	 * see BlobFileIn::setPipelineMode()
+	 *
+	 * @param threadCount number of decoder threads, 0 disables pipeline mode
+	 * @param queueDepth maximum number of blocks decoded ahead, defaults to 2 * threadCount
+	 */
+	void setPipelineMode(uint32_t threadCount, uint32_t queueDepth = 0);
+
+	/**
+	 * hint the expected access pattern of the input file to the kernel
+	 * see BlobFileIn::setAccessPattern()
+	 */
+	void setAccessPattern(AccessPattern pattern, bool hugePages = false);
+
+	/**
+	 * only read blocks containing any of the @wanted primitive types (combination of PrimitiveType)
+	 * Files sorted by type then id skip unwanted blobs without decompressing them. If nodes are not wanted,
+	 * reading starts at the first wanted blob found by binary search (builds the blob index if neccessary).
+	 * Blocks read by parseNextBlock() skip the primitive groups of unwanted types without decoding them.
+	 * see BlobFileIn::setPrimitiveFilter()
+	 */
+	void setPrimitiveTypes(PrimitiveTypeFlags wanted);
+	PrimitiveTypeFlags primitiveTypes() const;
+
+	///@return true if the header declares the file as sorted by type then id ("Sort.Type_then_ID")
+	bool sortedByType() const;
 
 	bool hasNext() const;
 
@@ -62,11 +92,15 @@ public:
 
 	/**
 	 * copy next block into data buffer
+	 * missing or too small memory is taken from BlobBufferPool::global(), release it there when done
 	 *
 	 * @param buffer target buffer
 	 */
 	bool getNextBlock(BlobDataBuffer & buffer);
 
+	///getNextBlock() which also returns the primitive filter to pass to PrimitiveBlockInputAdaptor::parseData()
+	bool getNextBlock(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes);
+
 	/**
 	 * copy num blocks into data buffers
 	 * Thread-safety: blocks may not be in order
@@ -76,9 +110,85 @@ public:
 	 */
 	bool getNextBlocks(BlobDataMultiBuffer & buffers, int num);
 
-	///@param adaptor parse next block by @adaptor, not thread-safe
+	/**
+	 * @param adaptor parse next block by @adaptor, not thread-safe
+	 * raw blobs of mapped files are parsed without copying, blockBuffer() stays empty then
+	 * lazily decoding adaptors refer to blockBuffer(), which is reused by the next block read from this file
+	 */
 	bool parseNextBlock(PrimitiveBlockInputAdaptor & adaptor);
 
+	/**
+	 * build the blob index with a single pass over all blob headers
+	 *
+	 * @param primitiveInfo additionally decode every blob to record its primitive types and id range
+	 */
+	bool buildBlobIndex(bool primitiveInfo = false);
+
+	/**
+	 * load a previously saved blob index, fails if it does not match this file
+	 *
+	 * @param fileName index file, defaults to BlobIndex::sidecarFileName() of the input file
+	 */
+	bool loadBlobIndex(const std::string & fileName = std::string());
+
+	///@param fileName index file, defaults to BlobIndex::sidecarFileName() of the input file
+	bool saveBlobIndex(const std::string & fileName = std::string()) const;
+
+	///@return current blob index of data blobs or NULL if none was built or loaded
+	inline const BlobIndex * blobIndex() const { return m_BlobIndex; }
+
+	///number of data blobs, builds the blob index if neccessary
+	SizeType blobCount();
+
+	///move to data blob @n (blobCount() moves to the end), builds the blob index if neccessary, not thread-safe
+	bool seekBlob(SizeType n);
+
+	/**
+	 * find the data blob containing the primitive of @type with @id, builds the blob index if neccessary
+	 * Files sorted by type then id are searched with O(log blobCount()) blob decodes, other files are
+	 * scanned blob by blob (blobs are skipped by the primitive info of the blob index if it has some).
+	 * The current position is not changed, use seekBlob() to read the blob.
+	 *
+	 * @return number of the data blob or blobCount() if there is no such primitive
+	 */
+	SizeType findBlobContaining(PrimitiveType type, int64_t id);
+
+	/**
+	 * data range [@begin, @end) of shard @shard when splitting the data into @shardCount parts
+	 * Boundaries are spread evenly by size and moved to the next blob start, taken from the blob index
+	 * if one was built or loaded and resynchronized from the raw bytes otherwise. Every process computes
+	 * the same boundaries, so shards can be processed independently without any coordination.
+	 */
+	bool shardRange(uint32_t shard, uint32_t shardCount, uint64_t & begin, uint64_t & end) const;
+
+	/**
+	 * restrict reading to shard @shard of @shardCount (see shardRange()) and move to its start
+	 * reset() returns to the start of the shard, setShard(0, 1) reads the whole file again
+	 */
+	bool setShard(uint32_t shard, uint32_t shardCount);
+
+	///data range of the current shard, [0, dataSize()) if no shard is set
+	inline uint64_t shardBegin() const { return m_ShardBegin; }
+	uint64_t shardEnd() const;
+
+	/**
+	 * read the blob at file offset @offset (see blobIndex()) without changing the current position
+	 * thread-safe, the primitive filter is not applied (see wantedBlock())
+	 * missing or too small memory is taken from BlobBufferPool::global(), release it there when done
+	 */
+	bool readBlobAt(uint64_t offset, BlobDataBuffer & buffer) const;
+
+	///@return false if the decoded @buffer contains only unwanted primitive types, thread-safe
+	bool wantedBlock(const BlobDataBuffer & buffer) const;
+
+	/**
+	 * numbers of the blobs of the current shard (see blobIndex()) which may contain wanted primitive types
+	 * Decided by the primitive info of the blob index if present and by the first primitive types of the
+	 * blobs in files sorted by type otherwise, all blobs are kept in other files. Builds the blob index
+	 * if neccessary, the current position is not changed.
+	 */
+	bool wantedBlobs(std::vector<SizeType> & blobs);
+
 	inline const BlobDataBuffer & blockBuffer() const { return m_DataBuffer; }
 	inline void clearBlockBuffer() { m_DataBuffer.clear(); }
 
@@ -115,9 +225,25 @@ protected:
 	crosby::binary::HeaderBlock * m_FileHeader;
 	std::vector< bool > m_MissingFeatures;
 
+	BlobIndex * m_BlobIndex;
+
 	SizeType m_DataOffset;
+	///start of the current shard in data positions
+	uint64_t m_ShardBegin;
 
 	bool parseHeader();
+
+	///data position of the first blob starting at or behind the start of shard @shard
+	uint64_t shardBoundary(uint32_t shard, uint32_t shardCount) const;
+
+	///sorted files without wanted nodes: move to the last blob in front of the first wanted one
+	void seekFirstWantedBlob();
+
+	///primitive types and id range of data blob @n, taken from the blob index if it has primitive info
+	bool blobPrimitiveInfo(SizeType n, BlobIndexEntry & entry) const;
+
+	///decode and parse data blob @n to look for the primitive of @type with @id
+	bool blobContains(SizeType n, PrimitiveType type, int64_t id) const;
 };
 
 } // namespace osmpbf
@@ -23,9 +23,12 @@
 
 #include <osmpbf/osmfilein.h>
 #include <osmpbf/primitiveblockinputadaptor.h>
+#include <osmpbf/blobbufferpool.h>
 
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <thread>
 #include <type_traits>
 
@@ -91,7 +94,17 @@ uint32_t parseFileCPPThreads(T_IN_DATA & inFile, TPBI_Processor processor,
 							bool threadPrivateProcessor = false,
 							uint32_t maxBlobsToRead = 0xFFFFFFFF
 						);
-						
+
+///Parses blocks in parallel but hands them to @processor one at a time in file order
+///@warning processor is passed by value! Pass a pointer to avoid copying
+///@inFile currently either OSMFileIn or PbiStream, enable its pipeline mode to decompress in parallel as well
+///@processor (osmpbf::PrimitiveBlockInputAdaptor & pbi) if the return value is not void, then the processing stops if its evaluated to false
+///@threadCount number of parsing threads, if this is set to zero then this will default to max(std::thread::hardware_concurrency(), 1)
+///@windowSize maximum number of blocks read but not yet processed (bounds the memory use), defaults to 2 * threadCount
+///@return number of blocks processed
+template<typename TPBI_Processor, typename T_IN_DATA>
+uint32_t parseFileOrdered(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threadCount = 0, uint32_t windowSize = 0);
+
 
 }// end namespace osmpbf
 
@@ -122,21 +135,23 @@ void parseFileOmp(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t readBlo
 		#endif
 	}
 
-	std::vector<osmpbf::BlobDataBuffer> pbiBuffers;
+	std::vector<osmpbf::BlobDataBuffer> pbiBuffers(readBlobCount);
+	std::vector<osmpbf::PrimitiveTypeFlags> pbiTypes(readBlobCount);
 	bool processedFile = false;
 
 	while (!processedFile)
 	{
-		pbiBuffers.clear();
-		inFile.getNextBlocks(pbiBuffers, readBlobCount);
-		std::size_t pbiCount = pbiBuffers.size();
+		std::size_t pbiCount = 0;
+		while (pbiCount < readBlobCount && inFile.getNextBlock(pbiBuffers[pbiCount], pbiTypes[pbiCount]))
+			++pbiCount;
 		processedFile = (pbiCount < readBlobCount);
 
 		#pragma omp parallel for schedule(dynamic)
 		for(std::size_t i = 0; i < pbiCount; ++i)
 		{
-			osmpbf::PrimitiveBlockInputAdaptor pbi(pbiBuffers[i].data, pbiBuffers[i].availableBytes);
-			pbiBuffers[i].clear();
+			osmpbf::PrimitiveBlockInputAdaptor pbi;
+			pbi.parseData(pbiBuffers[i].data, pbiBuffers[i].availableBytes, false, pbiTypes[i]);
+			osmpbf::BlobBufferPool::global().release(pbiBuffers[i]);
 			if (pbi.isNull())
 			{
 				continue;
@@ -175,11 +190,14 @@ parseFileCPPThreads(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threa
 		}
 		osmpbf::PrimitiveBlockInputAdaptor pbi;
 		std::vector<osmpbf::BlobDataBuffer> dbufs;
+		std::vector<osmpbf::PrimitiveTypeFlags> dtypes;
 		dbufs.reserve(readBlobCount);
+		dtypes.reserve(readBlobCount);
 
 		while (doProcessing && blobsRead < maxBlobsToRead)
 		{
 			dbufs.clear();
+			dtypes.clear();
 			while(dbufs.size() < readBlobCount) {
 				//pretend that we have read another blob
 				auto prevBlobsRead = blobsRead.fetch_add(1);
@@ -190,8 +208,10 @@ parseFileCPPThreads(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threa
 				}
 				//read our blob
 				osmpbf::BlobDataBuffer bdb;
-				if (inFile.getNextBlock(bdb)) {
+				osmpbf::PrimitiveTypeFlags types;
+				if (inFile.getNextBlock(bdb, types)) {
 					dbufs.emplace_back( std::move(bdb) );
+					dtypes.emplace_back(types);
 				}
 				else {
 					blobsRead -= 1;
@@ -199,8 +219,11 @@ parseFileCPPThreads(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threa
 				}
 			}
 			
-			for(osmpbf::BlobDataBuffer & dbuf : dbufs) {
-				pbi.parseData(dbuf.data, dbuf.availableBytes);
+			for(std::size_t i(0); i < dbufs.size(); ++i) {
+				osmpbf::BlobDataBuffer & dbuf = dbufs[i];
+				pbi.parseData(dbuf.data, dbuf.availableBytes, false, dtypes[i]);
+				//the next blob read draws the memory from the pool again
+				osmpbf::BlobBufferPool::global().release(dbuf);
 				//make sure this does not get optimized away
 				bool tmp = detail::PbiProcessor<MyPbiProcessor, PBIProcessorReturnType>::process(*myP, pbi);
 				doProcessing = tmp && doProcessing;
@@ -230,6 +253,119 @@ parseFileCPPThreads(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threa
 	return blobsRead;
 }
 
+template<typename TPBI_Processor, typename T_IN_DATA>
+uint32_t
+parseFileOrdered(T_IN_DATA & inFile, TPBI_Processor processor, uint32_t threadCount, uint32_t windowSize)
+{
+	typedef typename std::conditional<std::is_pointer<TPBI_Processor>::value, typename std::remove_pointer<TPBI_Processor>::type, TPBI_Processor>::type MyPbiProcessor;
+	typedef typename std::result_of<MyPbiProcessor(osmpbf::PrimitiveBlockInputAdaptor&)>::type PBIProcessorReturnType;
+	typedef detail::ProcessorPtr<TPBI_Processor> ProcessorPtrCreator;
+
+	struct Slot {
+		osmpbf::PrimitiveBlockInputAdaptor pbi;
+		bool ready = false;
+	};
+
+	if (!threadCount)
+	{
+		threadCount = std::max<int>(std::thread::hardware_concurrency(), 1);
+	}
+
+	if (!windowSize)
+	{
+		windowSize = 2 * threadCount;
+	}
+
+	std::unique_ptr<Slot[]> slots(new Slot[windowSize]);
+
+	//reading and claiming sequence numbers
+	std::mutex readLock;
+	uint64_t readSeq = 0;
+	bool readerDone = false;
+
+	//window state, guarded by stateLock
+	std::mutex stateLock;
+	std::condition_variable slotFreed;
+	uint64_t deliverSeq = 0;
+	//blocks handed to the processor, null blocks are delivered but not processed
+	uint64_t processedCount = 0;
+	bool delivering = false;
+	bool doProcessing = true;
+
+	MyPbiProcessor * myP = ProcessorPtrCreator::ptr(processor);
+
+	auto workFunc = [&]()
+	{
+		osmpbf::BlobDataBuffer dbuf;
+		osmpbf::PrimitiveTypeFlags types;
+
+		for (;;)
+		{
+			uint64_t seq;
+			{
+				std::unique_lock<std::mutex> rlck(readLock);
+				{
+					std::unique_lock<std::mutex> slck(stateLock);
+					slotFreed.wait(slck, [&]() { return !doProcessing || readSeq < deliverSeq + windowSize; });
+
+					if (!doProcessing)
+						break;
+				}
+
+				if (readerDone || !inFile.getNextBlock(dbuf, types)) {
+					readerDone = true;
+					break;
+				}
+
+				seq = readSeq++;
+			}
+
+			Slot & slot = slots[seq % windowSize];
+			slot.pbi.parseData(dbuf.data, dbuf.availableBytes, false, types);
+			//the next blob read draws the memory from the pool again
+			osmpbf::BlobBufferPool::global().release(dbuf);
+
+			std::unique_lock<std::mutex> slck(stateLock);
+			slot.ready = true;
+
+			//another thread is already handing out blocks and picks this one up as well
+			if (delivering)
+				continue;
+
+			delivering = true;
+			while (doProcessing && slots[deliverSeq % windowSize].ready) {
+				Slot & next = slots[deliverSeq % windowSize];
+				slck.unlock();
+
+				const bool process = !next.pbi.isNull();
+				bool ok = !process || detail::PbiProcessor<MyPbiProcessor, PBIProcessorReturnType>::process(*myP, next.pbi);
+
+				slck.lock();
+				next.ready = false;
+				++deliverSeq;
+				processedCount += process;
+				doProcessing = ok && doProcessing;
+				slotFreed.notify_all();
+			}
+			delivering = false;
+		}
+	};
+
+	std::vector<std::thread> ts;
+	ts.reserve(threadCount);
+	for(uint32_t i(0); i < threadCount; ++i)
+	{
+		ts.push_back(std::thread(workFunc));
+	}
+
+	for(std::thread & t : ts)
+	{
+		t.join();
+	}
+
+	return uint32_t(processedCount);
+}
+
 
 } //end namespace osmpbf
 
@@ -2,9 +2,9 @@
 #define OSMPBF_PBISTREAM_H
 #include <osmpbf/typelimits.h>
 #include <osmpbf/osmfilein.h>
+#include <atomic>
 #include <memory>
 #include <vector>
-#include <mutex>
 
 namespace osmpbf {
 namespace interface {
@@ -19,8 +19,13 @@ public:
 	virtual SizeType position() const = 0;
 	virtual SizeType size() const = 0;
 
+	virtual SizeType blobCount() = 0;
+	virtual bool seekBlob(SizeType n) = 0;
+	virtual SizeType findBlobContaining(PrimitiveType type, int64_t id) = 0;
+
 	virtual bool hasNext() const = 0;
 	virtual bool getNext(BlobDataBuffer & buffer) = 0;
+	virtual bool getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) = 0;
 	virtual bool getNext(BlobDataMultiBuffer & buffers, int num) = 0;
 	virtual bool parseNext(PrimitiveBlockInputAdaptor & adaptor) = 0;
 
@@ -40,14 +45,27 @@ public:
 	virtual SizeType position() const override;
 	virtual SizeType size() const override;
 
+	virtual SizeType blobCount() override;
+	virtual bool seekBlob(SizeType n) override;
+	virtual SizeType findBlobContaining(PrimitiveType type, int64_t id) override;
+
 	virtual bool hasNext() const override;
 	virtual bool getNext(BlobDataBuffer & buffer) override;
+	virtual bool getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) override;
 	virtual bool getNext(BlobDataMultiBuffer & buffers, int num) override;
 	virtual bool parseNext(PrimitiveBlockInputAdaptor & adaptor) override;
 private:
 	OSMFileIn m_file;
 };
 
+/**
+ * Blobs of all files are listed up front (building the blob indices if neccessary) and claimed
+ * through an atomic cursor, so concurrent readers decode in parallel without holding any lock.
+ * Each file keeps its primitive filter and shard, the positions of the single files are not used.
+ * Blobs which can't contain wanted primitives (see OSMFileIn::wantedBlobs()) are not listed.
+ * Blobs are read by position (OSMFileIn::readBlobAt()), so all files have to be seekable and their
+ * pipeline mode and read-ahead are not used. Construction throws std::runtime_error if a file can't be indexed.
+ */
 class MultiFilePbiStream: public interface::PbiStream {
 public:
 	///distance(begin, end) > 0!
@@ -60,20 +78,35 @@ public:
 	virtual SizeType position() const override;
 	virtual SizeType size() const override;
 
+	virtual SizeType blobCount() override;
+	virtual bool seekBlob(SizeType n) override;
+	virtual SizeType findBlobContaining(PrimitiveType type, int64_t id) override;
+
 	virtual bool hasNext() const override;
 	virtual bool getNext(BlobDataBuffer & buffer) override;
+	virtual bool getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) override;
 	virtual bool getNext(BlobDataMultiBuffer & buffers, int num) override;
 	virtual bool parseNext(PrimitiveBlockInputAdaptor & adaptor) override;
 protected:
-	OSMFileIn & currentFile();
-	const OSMFileIn & currentFile() const;
+	struct BlobRef {
+		uint32_t file;
+		///offset within the file
+		uint64_t offset;
+		///data position within the stream
+		SizeType position;
+	};
+
+	void buildBlobList();
+	///claim up to @count blobs starting at @first, @return number of claimed blobs
+	SizeType claimBlobs(SizeType count, SizeType & first);
+	///read and decode blob @n, @return false on errors
+	bool readBlob(SizeType n, BlobDataBuffer & buffer) const;
 private:
-	std::mutex m_lock;
 	std::vector<OSMFileIn> m_files;
 	std::vector<SizeType> m_clDataSize; //cumulative data size
+	std::vector<BlobRef> m_blobs; //data blobs of all files in stream order
+	std::atomic<SizeType> m_nextBlob;
 	SizeType m_dataSize;
-	SizeType m_position;
-	std::size_t m_currentFile;
 };
 
 }//end namespace imp
@@ -101,6 +134,25 @@ public:
 
 	SizeType size() const;
 
+	///number of data blobs in all files, builds the blob indices if neccessary
+	SizeType blobCount();
+
+	///move to data blob @n counted over all files, builds the blob indices if neccessary
+	///not thread-safe
+	bool seekBlob(SizeType n);
+
+	/**
+	 * find the data blob containing the primitive of @type with @id, see OSMFileIn::findBlobContaining()
+	 * builds the blob indices if neccessary, the current position is not changed
+	 * multiple files: if the blob was left out by the primitive filter, the next listed blob is returned
+	 *
+	 * @return number of the data blob counted over all files or blobCount() if there is no such primitive
+	 */
+	SizeType findBlobContaining(PrimitiveType type, int64_t id);
+
+	///move to the data blob containing the primitive of @type with @id, not thread-safe
+	bool seekPrimitive(PrimitiveType type, int64_t id);
+
 	bool hasNext() const;
 
 	/**
@@ -111,6 +163,12 @@ public:
 	 */
 	bool getNext(BlobDataBuffer & buffer);
 
+	/**
+	 * getNext() which also returns the primitive filter of the file the block was read from
+	 * pass it to PrimitiveBlockInputAdaptor::parseData() to skip unwanted primitive groups
+	 */
+	bool getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes);
+
 	/**
 	 * copy next blocks into data buffers
 	 * not thread-safe
@@ -120,7 +178,12 @@ public:
 	 */
 	bool getNext(BlobDataMultiBuffer & buffers, int num);
 
-	///@param adaptor parse next block by @adaptor, not thread-safe
+	/**
+	 * @param adaptor parse next block by @adaptor, not thread-safe
+	 * The block data stays valid for lazy decoding (see PrimitiveBlockInputAdaptor::setLazyDecoding())
+	 * until the next parseNext() call with the same adaptor. Streams over a single file share one
+	 * block buffer, so use one adaptor per stream in lazy mode.
+	 */
 	bool parseNext(PrimitiveBlockInputAdaptor & adaptor);
 	
 	
@@ -130,6 +193,7 @@ public:
 	SizeType dataPosition() const;
 	SizeType dataSize() const;
 	bool getNextBlock(BlobDataBuffer & buffer);
+	bool getNextBlock(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes);
 
 	bool getNextBlocks(BlobDataMultiBuffer & buffers, int num);
 	bool parseNextBlock(PrimitiveBlockInputAdaptor & adaptor);
@@ -145,9 +209,8 @@ namespace imp {
 
 template<typename T_OSMFILE_IN_ITERATOR>
 MultiFilePbiStream::MultiFilePbiStream(T_OSMFILE_IN_ITERATOR begin, T_OSMFILE_IN_ITERATOR end) :
-m_dataSize(0),
-m_position(0),
-m_currentFile(0)
+m_nextBlob(0),
+m_dataSize(0)
 {
 	using std::distance;
 	auto dst = distance(begin, end);
@@ -159,6 +222,7 @@ m_currentFile(0)
 		m_files.emplace_back( std::move(*begin) );
 	}
 	m_clDataSize.emplace_back(m_dataSize);
+	buildBlobList();
 }
 
 
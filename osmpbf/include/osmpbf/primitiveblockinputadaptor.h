@@ -22,6 +22,7 @@
 #define OSMPBF_PRIMITIVEBLOCKINPUTADAPTOR_H
 
 #include <osmpbf/common_input.h>
+#include <osmpbf/blobdata.h>
 #include <osmpbf/pbf_prototypes.h>
 #include <osmpbf/typelimits.h>
 #include <osmpbf/dataindex.h>
@@ -37,6 +38,82 @@
 namespace osmpbf
 {
 
+/**
+ * Nodes of a primitive block stored column by column, filled by PrimitiveBlockInputAdaptor::getNodeColumns.
+ * The tags of node i are keys[tagOffsets[i]] = values[tagOffsets[i]] up to tagOffsets[i + 1].
+ * There is a row for every node, dense groups without complete coordinate columns get raw coordinate 0.
+ * Reuse one instance for many blocks to keep its memory.
+ */
+struct NodeColumns
+{
+	std::vector<int64_t> ids;
+	///WGS84 latitudes in nanodegrees
+	std::vector<int64_t> lats;
+	///WGS84 longitudes in nanodegrees
+	std::vector<int64_t> lons;
+
+	///size() + 1 offsets into keys and values
+	std::vector<uint32_t> tagOffsets;
+	///string ids
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> values;
+
+	inline SizeType size() const { return ids.size(); }
+	inline uint32_t tagsSize(SizeType index) const { return tagOffsets[index + 1] - tagOffsets[index]; }
+
+	void clear();
+};
+
+/**
+ * Metadata of the nodes of a primitive block, filled by PrimitiveBlockInputAdaptor::getNodeInfoColumns.
+ * Entry i belongs to node i of the NodeColumns of the same types, fields missing in the block are -1 (like in IInfo).
+ * Both have a row for every node, also for dense groups with malformed columns.
+ */
+struct NodeInfoColumns
+{
+	std::vector<int32_t> versions;
+	///raw timestamps, multiply by PrimitiveBlockInputAdaptor::dateGranularity() for milliseconds
+	std::vector<int64_t> timestamps;
+	std::vector<int64_t> changesets;
+	std::vector<int32_t> userIds;
+	///string ids of the user names
+	std::vector<int32_t> userStringIds;
+
+	inline SizeType size() const { return versions.size(); }
+
+	void clear();
+};
+
+/**
+ * Node refs and tags of all ways of a primitive block, filled by PrimitiveBlockInputAdaptor::getWayRefs.
+ * The refs of way i are refs[refOffsets[i]] up to refOffsets[i + 1], its tags are stored like in NodeColumns.
+ * Reuse one instance for many blocks to keep its memory.
+ */
+struct WayRefs
+{
+	///way ids
+	std::vector<int64_t> ids;
+	///size() + 1 offsets into refs
+	std::vector<uint32_t> refOffsets;
+	///decoded node ids
+	std::vector<int64_t> refs;
+
+	///size() + 1 offsets into keys and values
+	std::vector<uint32_t> tagOffsets;
+	///string ids
+	std::vector<uint32_t> keys;
+	std::vector<uint32_t> values;
+
+	inline SizeType size() const { return ids.size(); }
+	inline uint32_t refsSize(SizeType index) const { return refOffsets[index + 1] - refOffsets[index]; }
+	inline uint32_t tagsSize(SizeType index) const { return tagOffsets[index + 1] - tagOffsets[index]; }
+
+	void clear();
+};
+
+class NodeRange;
+class WayRange;
+
 class PrimitiveBlockInputAdaptor
 {
 /**
@@ -60,26 +137,94 @@ public:
 	};
 public:
 	PrimitiveBlockInputAdaptor();
-	PrimitiveBlockInputAdaptor(char * rawData, SizeType length, bool unpackDense = false);
+	PrimitiveBlockInputAdaptor(const char * rawData, SizeType length, bool unpackDense = false);
 	virtual ~PrimitiveBlockInputAdaptor();
 
-	void parseData(char * rawData, SizeType length, bool unpackDense = false);
+	/**
+	 * parse the serialized primitive block @rawData
+	 *
+	 * @param types only decode primitive groups containing any of these primitive types (combination of PrimitiveType),
+	 *        other groups are skipped without decoding them and the block looks as if it didn't contain them
+	 */
+	void parseData(const char * rawData, SizeType length, bool unpackDense = false, PrimitiveTypeFlags types = AllPrimitives);
+
+	/**
+	 * parse the block in @buffer and take over its memory, @buffer is left empty
+	 * The memory stays valid (e.g. for lazy decoding) until the next parseData or clear call
+	 * and is released into BlobBufferPool::global() then.
+	 */
+	void parseData(BlobDataBuffer && buffer, bool unpackDense = false, PrimitiveTypeFlags types = AllPrimitives);
+
+	///drop the current block, isNull() returns true afterwards
+	void clear();
+
+	/**
+	 * Decode lazily instead of materializing the whole block with libprotobuf.
+	 * parseData then only indexes the string table and the primitive groups of @rawData.
+	 * Groups are decoded when a stream of their primitive type is requested for the first time
+	 * and strings are copied on their first query.
+	 * Takes effect with the next parseData call.
+	 *
+	 * warning: @rawData passed to parseData has to stay valid until the next parseData call,
+	 *          pass a BlobDataBuffer to hand its memory over to the adaptor instead
+	 */
+	inline void setLazyDecoding(bool enable) { m_LazyDecoding = enable; }
+	inline bool lazyDecoding() const { return m_LazyDecoding; }
 
 	const std::string & queryStringTable(int id) const;
 	int stringTableSize() const;
-	int findString(const std::string & str) const;
 
-//	INode getNodeAt(int position) const;
+	/**
+	 * @return id of @str in the string table or 0 if it is not part of it
+	 * The first call for a block builds a hash index of the string table, further lookups are O(1).
+	 * Not thread-safe, concurrent calls race on building the index although the method is const.
+	 *
+	 * @param previous only ids behind @previous are returned, pass the last result to find duplicates of @str
+	 */
+	int findString(const std::string & str, int previous = 0) const;
+
+	/**
+	 * random access to the primitive at @position, counted in stream order
+	 * The first call per block and type builds a table of group offsets, the node
+	 * accessor additionally decodes the delta coded columns of the dense group it hits.
+	 * @return null primitive if @position is out of range
+	 */
+	INode getNodeAt(int position);
 	int nodesSize(NodeTypeFlags type = PlainNode | DenseNode) const;
 
-//	IWay getWayAt(int position) const;
+	IWay getWayAt(int position);
 	int waysSize() const;
 
-//	IRelation getRelationAt(int position) const;
+	IRelation getRelationAt(int position);
 	int relationsSize() const;
 
 	INodeStream getNodeStream();
+
+	/**
+	 * decode all nodes of @type at once into @columns, in the same order as the node stream
+	 * previous contents of @columns are replaced
+	 */
+	void getNodeColumns(NodeColumns & columns, NodeTypeFlags type = PlainNode | DenseNode);
+
+	/**
+	 * decode the metadata (Info and DenseInfo) of all nodes of @type at once into @columns,
+	 * in the same order as the node stream, previous contents of @columns are replaced
+	 */
+	void getNodeInfoColumns(NodeInfoColumns & columns, NodeTypeFlags type = PlainNode | DenseNode);
 	IWayStream getWayStream();
+
+	/**
+	 * decode the node refs of all ways at once into @refs, in the same order as the way stream
+	 * previous contents of @refs are replaced
+	 */
+	void getWayRefs(WayRefs & refs);
+
+	/**
+	 * nodes and ways as ranges of non-virtual cursors, see primitivecursors.h
+	 * The primitives are decoded at once on the first call per block with getNodeColumns or getWayRefs.
+	 */
+	NodeRange nodes();
+	WayRange ways();
 	IRelationStream getRelationStream();
 
 	bool isNull() const
@@ -88,10 +233,13 @@ public:
 			m_PlainNodesGroups.size() ||
 			m_WaysGroups.size() ||
 			m_DenseNodesGroups.size() ||
-			m_RelationsGroups.size()));
+			m_RelationsGroups.size() ||
+			m_LazyGroups.size()));
 	}
 
 	int32_t granularity() const;
+	///milliseconds per unit of the timestamps in IInfo and NodeInfoColumns
+	int32_t dateGranularity() const;
 
 	int64_t latOffset() const;
 	int64_t lonOffset() const;
@@ -130,9 +278,59 @@ private:
 	friend class RelationInputAdaptor;
 	friend class RelationStreamInputAdaptor;
 	
+	///serialized string of the string table, not copied
+	struct StringRef
+	{
+		const char * data;
+		uint32_t length;
+	};
+
+	///serialized primitive group, decoded on demand
+	struct LazyGroup
+	{
+		const char * data;
+		uint32_t length;
+		PrimitiveTypeFlags types;
+		crosby::binary::PrimitiveGroup * group;
+	};
+
+	bool indexBlock(const char * rawData, SizeType length, PrimitiveTypeFlags types);
+	StringRef stringRef(int id) const;
+	void buildStringIndex() const;
+
+	///make groups containing @types available in the group vectors
+	void decodeGroups(PrimitiveTypeFlags types);
+	void addGroup(crosby::binary::PrimitiveGroup * group, PrimitiveTypeFlags types);
+
+	///first position of each group of @type followed by the count, nodes list plain before dense groups
+	const std::vector<int> & groupOffsets(PrimitiveType type);
+	///@return number of the group of @type holding @position and the @index within it, -1 if out of range
+	int findGroup(PrimitiveType type, int position, int & index);
+
+	///memory taken over by parseData(BlobDataBuffer &&)
+	BlobDataBuffer m_DataBuffer;
+
+	///current block, NULL if the last parseData call failed
 	crosby::binary::PrimitiveBlock * m_PrimitiveBlock;
+	///message reused by all parseData calls
+	crosby::binary::PrimitiveBlock * m_PrimitiveBlockStorage;
 	SizeType m_pc;
 
+	bool m_LazyDecoding;
+	bool m_LazyBlock;
+	bool m_UnpackDense;
+	PrimitiveTypeFlags m_WantedTypes;
+	PrimitiveTypeFlags m_DecodedTypes;
+
+	std::vector<StringRef> m_StringRefs;
+	mutable std::vector<std::string> m_Strings;
+	mutable std::vector<bool> m_StringsDecoded;
+	std::vector<LazyGroup> m_LazyGroups;
+
+	///open addressing hash table of string ids, 0 marks empty slots
+	mutable std::vector<int> m_StringIndex;
+	mutable bool m_StringIndexBuilt;
+
 	PrimitiveGroupVector m_PlainNodesGroups;
 	DenseNodesDataVector m_DenseNodesGroups;
 	PrimitiveGroupVector m_WaysGroups;
@@ -142,6 +340,17 @@ private:
 	int m_DenseNodesCount;
 	int m_WaysCount;
 	int m_RelationsCount;
+
+	///columns backing nodes() and ways()
+	NodeColumns m_NodeColumns;
+	WayRefs m_WayRefs;
+	PrimitiveTypeFlags m_ColumnTypes;
+
+	///group offsets backing the random access methods
+	std::vector<int> m_NodeGroupOffsets;
+	std::vector<int> m_WayGroupOffsets;
+	std::vector<int> m_RelationGroupOffsets;
+	PrimitiveTypeFlags m_OffsetTypes;
 };
 
 } // namespace osmpbf
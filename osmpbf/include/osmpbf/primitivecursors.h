@@ -0,0 +1,145 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_PRIMITIVECURSORS_H
+#define OSMPBF_PRIMITIVECURSORS_H
+
+#include <osmpbf/common.h>
+#include <osmpbf/primitiveblockinputadaptor.h>
+
+#include <cstdint>
+#include <string>
+
+namespace osmpbf
+{
+
+/**
+ * Non-virtual alternatives to INodeStream and IWayStream.
+ *
+ * The cursors are plain values walking the columns the block decodes on first use
+ * (see PrimitiveBlockInputAdaptor::getNodeColumns and getWayRefs), so every accessor
+ * can be inlined. A cursor is its own iterator, which allows range-based for loops:
+ *
+ *     for (auto & node : pbi.nodes())
+ *         process(node.id(), node.lati(), node.loni());
+ *
+ * Cursors are invalidated by the next parseData call of their block.
+ */
+
+/// common part of the cursors: block, position and iterator interface
+template<typename T_CURSOR, typename T_COLUMNS>
+class PrimitiveCursor
+{
+public:
+	PrimitiveCursor(const PrimitiveBlockInputAdaptor * block, const T_COLUMNS * columns, SizeType index) :
+		m_Block(block), m_Columns(columns), m_Index(index) {}
+
+	inline SizeType index() const { return m_Index; }
+
+	inline int64_t id() const { return m_Columns->ids[m_Index]; }
+
+	inline int tagsSize() const { return tagOffset(m_Index + 1) - tagOffset(m_Index); }
+	inline uint32_t keyId(int index) const { return m_Columns->keys[tagOffset(m_Index) + index]; }
+	inline uint32_t valueId(int index) const { return m_Columns->values[tagOffset(m_Index) + index]; }
+
+	inline const std::string & key(int index) const { return m_Block->queryStringTable(keyId(index)); }
+	inline const std::string & value(int index) const { return m_Block->queryStringTable(valueId(index)); }
+
+	inline T_CURSOR & operator*() { return static_cast<T_CURSOR &>(*this); }
+	inline const T_CURSOR & operator*() const { return static_cast<const T_CURSOR &>(*this); }
+
+	inline T_CURSOR & operator++() { ++m_Index; return static_cast<T_CURSOR &>(*this); }
+
+	inline bool operator==(const PrimitiveCursor & other) const { return m_Index == other.m_Index && m_Columns == other.m_Columns; }
+	inline bool operator!=(const PrimitiveCursor & other) const { return m_Index != other.m_Index || m_Columns != other.m_Columns; }
+
+protected:
+	inline uint32_t tagOffset(SizeType index) const { return m_Columns->tagOffsets[index]; }
+
+	const PrimitiveBlockInputAdaptor * m_Block;
+	const T_COLUMNS * m_Columns;
+	SizeType m_Index;
+};
+
+class NodeCursor : public PrimitiveCursor<NodeCursor, NodeColumns>
+{
+public:
+	NodeCursor(const PrimitiveBlockInputAdaptor * block, const NodeColumns * columns, SizeType index) :
+		PrimitiveCursor(block, columns, index) {}
+
+	///WGS84 coordinates in nanodegrees
+	inline int64_t lati() const { return m_Columns->lats[m_Index]; }
+	inline int64_t loni() const { return m_Columns->lons[m_Index]; }
+
+	inline double latd() const { return lati() * COORDINATE_SCALE_FACTOR_LAT; }
+	inline double lond() const { return loni() * COORDINATE_SCALE_FACTOR_LON; }
+};
+
+class WayCursor : public PrimitiveCursor<WayCursor, WayRefs>
+{
+public:
+	WayCursor(const PrimitiveBlockInputAdaptor * block, const WayRefs * columns, SizeType index) :
+		PrimitiveCursor(block, columns, index) {}
+
+	inline int refsSize() const { return m_Columns->refsSize(m_Index); }
+
+	///decoded node id, O(1)
+	inline int64_t ref(int index) const { return refBegin()[index]; }
+
+	inline const int64_t * refBegin() const { return m_Columns->refs.data() + m_Columns->refOffsets[m_Index]; }
+	inline const int64_t * refEnd() const { return m_Columns->refs.data() + m_Columns->refOffsets[m_Index + 1]; }
+};
+
+/// range of cursors, returned by PrimitiveBlockInputAdaptor::nodes() and ways()
+template<typename T_CURSOR, typename T_COLUMNS>
+class PrimitiveRange
+{
+public:
+	PrimitiveRange(const PrimitiveBlockInputAdaptor * block, const T_COLUMNS * columns) :
+		m_Block(block), m_Columns(columns) {}
+
+	inline T_CURSOR begin() const { return T_CURSOR(m_Block, m_Columns, 0); }
+	inline T_CURSOR end() const { return T_CURSOR(m_Block, m_Columns, m_Columns->size()); }
+
+	inline T_CURSOR operator[](SizeType index) const { return T_CURSOR(m_Block, m_Columns, index); }
+
+	inline SizeType size() const { return m_Columns->size(); }
+	inline bool empty() const { return !size(); }
+
+private:
+	const PrimitiveBlockInputAdaptor * m_Block;
+	const T_COLUMNS * m_Columns;
+};
+
+class NodeRange : public PrimitiveRange<NodeCursor, NodeColumns>
+{
+public:
+	NodeRange(const PrimitiveBlockInputAdaptor * block, const NodeColumns * columns) : PrimitiveRange(block, columns) {}
+};
+
+class WayRange : public PrimitiveRange<WayCursor, WayRefs>
+{
+public:
+	WayRange(const PrimitiveBlockInputAdaptor * block, const WayRefs * columns) : PrimitiveRange(block, columns) {}
+};
+
+} // namespace osmpbf
+
+#endif // OSMPBF_PRIMITIVECURSORS_H
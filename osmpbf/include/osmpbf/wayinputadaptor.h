@@ -60,6 +60,9 @@ public:
 	///          call this method very often or with a high index parameter.
 	int64_t ref(int index) const;
 
+	///decode all refsSize() node refs into @dest
+	void decodeRefs(int64_t * dest) const;
+
 	RefIterator refBegin() const;
 	RefIterator refEnd() const;
 
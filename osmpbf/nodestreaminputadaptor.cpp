@@ -37,6 +37,7 @@ NodeStreamInputAdaptor::NodeStreamInputAdaptor(PrimitiveBlockInputAdaptor * cont
 {
 	if (m_Controller)
 	{
+		controller->decodeGroups(NodePrimitive);
 		m_PlainGroupIterator = controller->m_PlainNodesGroups.begin();
 		m_DenseGroupIterator = controller->m_DenseNodesGroups.begin();
 	}
@@ -46,6 +47,58 @@ NodeStreamInputAdaptor::NodeStreamInputAdaptor(PrimitiveBlockInputAdaptor * cont
 	next();
 }
 
+NodeStreamInputAdaptor::NodeStreamInputAdaptor(PrimitiveBlockInputAdaptor * controller, int position) :
+	AbstractNodeInputAdaptor(controller),
+	m_GroupMode(NodeType::Undefined),
+	m_GroupNodeIndex(0),
+	m_Id(0),
+	m_Lat(0), m_Lon(0),
+	m_WGS84Lat(0), m_WGS84Lon(0)
+{
+	if (!m_Controller)
+		return;
+
+	int index;
+	const int group = controller->findGroup(NodePrimitive, position, index);
+
+	m_PlainGroupIterator = controller->m_PlainNodesGroups.end();
+	m_DenseGroupIterator = controller->m_DenseNodesGroups.end();
+
+	if (group < 0)
+		return;
+
+	const int plainGroups = controller->m_PlainNodesGroups.size();
+
+	m_GroupNodeIndex = index;
+
+	if (group < plainGroups)
+	{
+		m_PlainGroupIterator = controller->m_PlainNodesGroups.begin() + group;
+		m_DenseGroupIterator = controller->m_DenseNodesGroups.begin();
+		m_GroupMode = NodeType::PlainNode;
+
+		const crosby::binary::Node & node = (*m_PlainGroupIterator)->nodes(index);
+		m_Id = node.id();
+		m_Lat = node.lat();
+		m_Lon = node.lon();
+	}
+	else
+	{
+		m_DenseGroupIterator = controller->m_DenseNodesGroups.begin() + (group - plainGroups);
+		m_GroupMode = NodeType::DenseNode;
+
+		// random access needs the running sums instead of the deltas
+		m_DenseGroupIterator->unpackData();
+
+		const crosby::binary::DenseNodes & dense = m_DenseGroupIterator->group()->dense();
+		m_Id = dense.id(index);
+		m_Lat = dense.lat(index);
+		m_Lon = dense.lon(index);
+	}
+
+	updateWGS84();
+}
+
 bool NodeStreamInputAdaptor::isNull() const
 {
 	return AbstractPrimitiveInputAdaptor::isNull() ||
@@ -229,7 +282,8 @@ bool NodeStreamInputAdaptor::hasInfo() const
 	{
 	case NodeType::PlainNode:
 		return group->nodes(m_GroupNodeIndex).has_info();
-	case NodeType::DenseNode: //deal with this later
+	case NodeType::DenseNode:
+		return m_DenseGroupIterator->hasInfo();
 	case NodeType::Undefined:
 	default:
 		return false;
@@ -252,7 +306,8 @@ IInfo NodeStreamInputAdaptor::info() const
 			return IInfo(group->nodes(m_GroupNodeIndex).info());
 		}
 		return IInfo();
-	case NodeType::DenseNode: //deal with this later
+	case NodeType::DenseNode:
+		return m_DenseGroupIterator->info(m_GroupNodeIndex);
 	case NodeType::Undefined:
 	default:
 		return IInfo();
@@ -23,19 +23,56 @@
 #include "osmformat.pb.h"
 
 #include <osmpbf/blobfile.h>
+#include <osmpbf/blobbufferpool.h>
+#include <osmpbf/blobindex.h>
 #include <osmpbf/primitiveblockinputadaptor.h>
+#include <osmpbf/inode.h>
+#include <osmpbf/iway.h>
+#include <osmpbf/irelation.h>
 
+#include <algorithm>
 #include <iostream>
 #include <deque>
 
 namespace osmpbf {
 
+namespace {
+
+	template<typename T_STREAM>
+	bool streamContains(T_STREAM stream, int64_t id) {
+		for (; !stream.isNull(); stream.next()) {
+			if (stream.id() == id)
+				return true;
+		}
+
+		return false;
+	}
+
+	///type of the last primitive in a blob of a sorted file
+	inline PrimitiveType lastPrimitiveType(PrimitiveTypeFlags types) {
+		if (types & RelationPrimitive)
+			return RelationPrimitive;
+		if (types & WayPrimitive)
+			return WayPrimitive;
+
+		return PrimitiveType(types & NodePrimitive);
+	}
+
+	///order of files sorted by type then id
+	inline bool primitiveLess(PrimitiveType typeA, int64_t idA, PrimitiveType typeB, int64_t idB) {
+		return typeA < typeB || (typeA == typeB && idA < idB);
+	}
+
+}
+
 // OSMFileIn
 
 	OSMFileIn::OSMFileIn(const std::string & fileName, bool verboseOutput) :
 		m_FileIn(new BlobFileIn(fileName)),
 		m_FileHeader(NULL),
-		m_DataOffset(0)
+		m_BlobIndex(NULL),
+		m_DataOffset(0),
+		m_ShardBegin(0)
 	{
 		m_FileIn->setVerboseOutput(verboseOutput);
 	}
@@ -43,7 +80,9 @@ namespace osmpbf {
 	OSMFileIn::OSMFileIn(BlobFileIn * fileIn) :
 		m_FileIn(fileIn),
 		m_FileHeader(NULL),
-		m_DataOffset(0)
+		m_BlobIndex(NULL),
+		m_DataOffset(0),
+		m_ShardBegin(0)
 	{}
 
 	OSMFileIn::OSMFileIn(OSMFileIn&& other) :
@@ -51,44 +90,60 @@ namespace osmpbf {
 		m_DataBuffer(std::move(other.m_DataBuffer)),
 		m_FileHeader(other.m_FileHeader),
 		m_MissingFeatures(std::move(other.m_MissingFeatures)),
-		m_DataOffset(other.m_DataOffset)
+		m_BlobIndex(other.m_BlobIndex),
+		m_DataOffset(other.m_DataOffset),
+		m_ShardBegin(other.m_ShardBegin)
 	
 	{
 		other.m_FileIn = 0;
 		other.m_DataBuffer.clear();
 		other.m_FileHeader = 0;
 		other.m_MissingFeatures.clear();
+		other.m_BlobIndex = 0;
 		other.m_DataOffset = 0;
+		other.m_ShardBegin = 0;
 	}
 
 	
 	OSMFileIn::~OSMFileIn() {
 		delete m_FileIn;
 		delete m_FileHeader;
+		delete m_BlobIndex;
 	}
 
 	OSMFileIn& OSMFileIn::operator=(OSMFileIn&& other)
 	{
 		delete m_FileIn;
 		delete m_FileHeader;
+		delete m_BlobIndex;
 	
 		m_FileIn = other.m_FileIn;
 		m_DataBuffer = std::move(other.m_DataBuffer);
 		m_FileHeader = other.m_FileHeader;
 		m_MissingFeatures = std::move(other.m_MissingFeatures);
+		m_BlobIndex = other.m_BlobIndex;
 		m_DataOffset = other.m_DataOffset;
+		m_ShardBegin = other.m_ShardBegin;
 		
 		other.m_FileIn = 0;
 		other.m_DataBuffer.clear();
 		other.m_FileHeader = 0;
 		other.m_MissingFeatures.clear();
+		other.m_BlobIndex = 0;
 		other.m_DataOffset = 0;
+		other.m_ShardBegin = 0;
 		return *this;
 	}
 
 	bool OSMFileIn::open() {
-		if (m_FileIn->open() && parseHeader())
+		// the read limit of a previous shard is dropped by m_FileIn->open()
+		m_ShardBegin = 0;
+
+		if (m_FileIn->open() && parseHeader()) {
+			m_FileIn->setPrimitiveFilter(primitiveTypes(), sortedByType());
+			seekFirstWantedBlob();
 			return true;
+		}
 
 		close();
 		return false;
@@ -100,7 +155,8 @@ namespace osmpbf {
 	}
 
 	void OSMFileIn::reset() {
-		dataSeek(0);
+		dataSeek(m_ShardBegin);
+		seekFirstWantedBlob();
 	}
 
 	void OSMFileIn::dataSeek(osmpbf::OffsetType position) {
@@ -119,9 +175,70 @@ namespace osmpbf {
 		return m_FileIn->size();
 	}
 	
+	void OSMFileIn::setPipelineMode(uint32_t threadCount, uint32_t queueDepth) {
+		m_FileIn->setPipelineMode(threadCount, queueDepth);
+	}
+
+	void OSMFileIn::setAccessPattern(AccessPattern pattern, bool hugePages) {
+		m_FileIn->setAccessPattern(pattern, hugePages);
+	}
+
+	void OSMFileIn::setPrimitiveTypes(PrimitiveTypeFlags wanted) {
+		m_FileIn->setPrimitiveFilter(wanted, sortedByType());
+
+		if (m_FileHeader && dataPosition() == m_ShardBegin)
+			seekFirstWantedBlob();
+	}
+
+	PrimitiveTypeFlags OSMFileIn::primitiveTypes() const {
+		return m_FileIn->wantedPrimitives();
+	}
+
+	bool OSMFileIn::sortedByType() const {
+		if (!m_FileHeader)
+			return false;
+
+		for (int i = 0; i < optionalFeaturesSize(); ++i) {
+			if (optionalFeatures(i) == "Sort.Type_then_ID")
+				return true;
+		}
+
+		return false;
+	}
+
+	void OSMFileIn::seekFirstWantedBlob() {
+		PrimitiveTypeFlags wanted = primitiveTypes();
+
+		// only leading node blobs of sorted files can be skipped by seeking
+		if (!wanted || (wanted & NodePrimitive) || !sortedByType())
+			return;
+
+		if (!m_BlobIndex && !buildBlobIndex())
+			return;
+
+		PrimitiveTypeFlags lowestWanted = wanted & -wanted;
+
+		// first blob starting with a wanted or later type, unknown types are treated as later
+		SizeType low = 0;
+		SizeType high = m_BlobIndex->size();
+		while (low < high) {
+			SizeType mid = low + (high - low) / 2;
+			PrimitiveType type = m_FileIn->peekPrimitiveType(m_BlobIndex->at(mid).offset);
+
+			if (type != NoPrimitive && type < lowestWanted)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		// the blob in front may end with the first wanted primitives
+		if (low && m_BlobIndex->at(low - 1).offset > m_FileIn->position())
+			m_FileIn->seek(m_BlobIndex->at(low - 1).offset);
+	}
+
 	bool OSMFileIn::hasNext() const
 	{
-		return m_FileIn->position() < m_FileIn->size();
+		return !m_FileIn->atEnd();
 	}
 
 
@@ -130,6 +247,11 @@ namespace osmpbf {
 		return buffer.type != BLOB_Invalid;
 	}
 
+	bool OSMFileIn::getNextBlock(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) {
+		wantedTypes = primitiveTypes();
+		return getNextBlock(buffer);
+	}
+
 	bool OSMFileIn::getNextBlocks(osmpbf::BlobDataMultiBuffer& buffers, int num) {
 		// read (all) buffers
 		int i = 0;
@@ -148,9 +270,37 @@ namespace osmpbf {
 	}
 
 	bool OSMFileIn::parseNextBlock(PrimitiveBlockInputAdaptor & adaptor) {
-		m_FileIn->readBlob(m_DataBuffer);
-		adaptor.parseData(m_DataBuffer.data, m_DataBuffer.availableBytes);
-		return m_DataBuffer.type != BLOB_Invalid;
+		// don't leave the previous block behind if reading fails
+		adaptor.clear();
+
+		if (m_FileIn->blobViewsAvailable()) {
+			BlobView view;
+			do {
+				if (!m_FileIn->readBlobView(view))
+					return false;
+
+				// raw blobs are parsed straight from the mapped file
+				if (view.isRaw()) {
+					m_DataBuffer.type = view.type;
+					m_DataBuffer.availableBytes = 0;
+					adaptor.parseData(view.data, view.dataSize, false, primitiveTypes());
+					return true;
+				}
+
+				if (!decodeBlobView(view, m_DataBuffer))
+					return false;
+			} while (!m_FileIn->wantedPrimitiveBlock(m_DataBuffer.data, m_DataBuffer.availableBytes));
+		}
+		else {
+			m_FileIn->readBlob(m_DataBuffer);
+
+			// the buffer may still hold data of the previous block
+			if (m_DataBuffer.type == BLOB_Invalid)
+				return false;
+		}
+
+		adaptor.parseData(m_DataBuffer.data, m_DataBuffer.availableBytes, false, primitiveTypes());
+		return true;
 	}
 
 	bool OSMFileIn::skipBlock() {
@@ -162,6 +312,265 @@ namespace osmpbf {
 		return m_DataBuffer.type != BLOB_Invalid;
 	}
 
+	bool OSMFileIn::buildBlobIndex(bool primitiveInfo) {
+		BlobIndex * blobIndex = new BlobIndex();
+
+		if (!blobIndex->build(*m_FileIn, m_DataOffset, primitiveInfo)) {
+			delete blobIndex;
+			return false;
+		}
+
+		delete m_BlobIndex;
+		m_BlobIndex = blobIndex;
+		return true;
+	}
+
+	bool OSMFileIn::loadBlobIndex(const std::string & fileName) {
+		BlobIndex * blobIndex = new BlobIndex();
+
+		if (!blobIndex->load(fileName.empty() ? BlobIndex::sidecarFileName(m_FileIn->fileName()) : fileName)) {
+			delete blobIndex;
+			return false;
+		}
+
+		bool matches = blobIndex->fileSize() == totalSize() && blobIndex->startPosition() == m_DataOffset;
+
+		// a stale index of a file with the same size passes the check above, compare some blob headers too
+		const SizeType count = blobIndex->size();
+		for (SizeType n : {SizeType(0), count / 2, count - 1}) {
+			if (!matches || n >= count)
+				break;
+
+			const BlobIndexEntry & entry = blobIndex->at(n);
+			uint32_t headerSize, dataSize;
+			BlobDataType type;
+			matches = m_FileIn->readBlobHeader(entry.offset, headerSize, dataSize, type) &&
+				headerSize == entry.headerSize && dataSize == entry.dataSize && type == entry.type;
+		}
+
+		if (!matches) {
+			std::cerr << "ERROR: blob index does not match input file" << std::endl;
+			delete blobIndex;
+			return false;
+		}
+
+		delete m_BlobIndex;
+		m_BlobIndex = blobIndex;
+		return true;
+	}
+
+	bool OSMFileIn::saveBlobIndex(const std::string & fileName) const {
+		if (!m_BlobIndex)
+			return false;
+
+		return m_BlobIndex->save(fileName.empty() ? BlobIndex::sidecarFileName(m_FileIn->fileName()) : fileName);
+	}
+
+	SizeType OSMFileIn::blobCount() {
+		if (!m_BlobIndex && !buildBlobIndex())
+			return 0;
+
+		return m_BlobIndex->size();
+	}
+
+	bool OSMFileIn::seekBlob(SizeType n) {
+		if (!m_BlobIndex && !buildBlobIndex())
+			return false;
+
+		if (n > m_BlobIndex->size())
+			return false;
+
+		m_FileIn->seek(n < m_BlobIndex->size() ? m_BlobIndex->at(n).offset : totalSize());
+		return true;
+	}
+
+	SizeType OSMFileIn::findBlobContaining(PrimitiveType type, int64_t id) {
+		if (!m_BlobIndex && !buildBlobIndex())
+			return 0; // blobCount() without index
+
+		SizeType count = m_BlobIndex->size();
+		BlobIndexEntry entry;
+
+		if (!sortedByType()) {
+			for (SizeType n = 0; n < count; ++n) {
+				if (m_BlobIndex->hasPrimitiveInfo() && !(m_BlobIndex->at(n).primitiveTypes & type))
+					continue;
+
+				if (blobContains(n, type, id))
+					return n;
+			}
+
+			return count;
+		}
+
+		// last blob starting in front of the primitive
+		// blobs without primitives (empty or unparsable) have no key, the first typed blob behind mid decides
+		SizeType low = 0;
+		SizeType high = count;
+		while (low < high) {
+			SizeType mid = low + (high - low) / 2;
+
+			SizeType typed = mid;
+			for (; typed < high; ++typed) {
+				if (!blobPrimitiveInfo(typed, entry))
+					return count;
+
+				if (entry.primitiveTypes != NoPrimitive)
+					break;
+			}
+
+			if (typed == high) {
+				high = mid;
+				continue;
+			}
+
+			PrimitiveType firstType = PrimitiveType(entry.primitiveTypes & -entry.primitiveTypes);
+
+			if (!primitiveLess(type, id, firstType, entry.firstId))
+				low = typed + 1;
+			else
+				high = mid;
+		}
+
+		for (SizeType n = low; n > 0; --n) {
+			if (!blobPrimitiveInfo(n - 1, entry))
+				return count;
+
+			if (entry.primitiveTypes == NoPrimitive)
+				continue;
+
+			if (primitiveLess(lastPrimitiveType(entry.primitiveTypes), entry.lastId, type, id) || !blobContains(n - 1, type, id))
+				return count;
+
+			return n - 1;
+		}
+
+		return count;
+	}
+
+	bool OSMFileIn::shardRange(uint32_t shard, uint32_t shardCount, uint64_t & begin, uint64_t & end) const {
+		if (!m_FileHeader || !shardCount || shard >= shardCount)
+			return false;
+
+		begin = shardBoundary(shard, shardCount);
+		end = shardBoundary(shard + 1, shardCount);
+		return true;
+	}
+
+	bool OSMFileIn::setShard(uint32_t shard, uint32_t shardCount) {
+		uint64_t begin;
+		uint64_t end;
+
+		if (!shardRange(shard, shardCount, begin, end))
+			return false;
+
+		m_ShardBegin = begin;
+		m_FileIn->setReadLimit(m_DataOffset + end);
+		reset();
+		return true;
+	}
+
+	uint64_t OSMFileIn::shardEnd() const {
+		return m_FileIn->readLimit() < totalSize() ? m_FileIn->readLimit() - m_DataOffset : dataSize();
+	}
+
+	bool OSMFileIn::readBlobAt(uint64_t offset, BlobDataBuffer & buffer) const {
+		return m_FileIn->readBlobAt(offset, buffer) != BLOB_Invalid;
+	}
+
+	bool OSMFileIn::wantedBlock(const BlobDataBuffer & buffer) const {
+		return buffer.type != BLOB_OSMData || m_FileIn->wantedPrimitiveBlock(buffer.data, buffer.availableBytes);
+	}
+
+	bool OSMFileIn::wantedBlobs(std::vector<SizeType> & blobs) {
+		if (!m_BlobIndex && !buildBlobIndex())
+			return false;
+
+		uint64_t begin = m_DataOffset + m_ShardBegin;
+		uint64_t end = m_DataOffset + shardEnd();
+		PrimitiveTypeFlags wanted = primitiveTypes();
+
+		for (SizeType n = 0, count = m_BlobIndex->size(); n < count; ++n) {
+			const BlobIndexEntry & entry = m_BlobIndex->at(n);
+			if (entry.offset < begin || entry.offset >= end)
+				continue;
+
+			if (entry.type == BLOB_OSMData && (wanted & AllPrimitives) != AllPrimitives) {
+				if (m_BlobIndex->hasPrimitiveInfo()) {
+					if (entry.primitiveTypes != NoPrimitive && !(entry.primitiveTypes & wanted))
+						continue;
+				}
+				else {
+					BlobFileIn::FilterAction action = m_FileIn->peekFilterAction(entry.offset, entry.endOffset());
+					if (action == BlobFileIn::FILTER_SkipRest)
+						break;
+					if (action == BlobFileIn::FILTER_Skip)
+						continue;
+				}
+			}
+
+			blobs.push_back(n);
+		}
+
+		return true;
+	}
+
+	uint64_t OSMFileIn::shardBoundary(uint32_t shard, uint32_t shardCount) const {
+		if (!shard)
+			return 0;
+
+		if (shard >= shardCount)
+			return dataSize();
+
+		uint64_t position = m_DataOffset + uint64_t(dataSize()) * shard / shardCount;
+
+		if (m_BlobIndex) {
+			const std::vector<BlobIndexEntry> & entries = m_BlobIndex->entries();
+			auto it = std::lower_bound(entries.cbegin(), entries.cend(), position,
+				[](const BlobIndexEntry & entry, uint64_t value) { return entry.offset < value; });
+
+			return (it != entries.cend() ? it->offset : totalSize()) - m_DataOffset;
+		}
+
+		return m_FileIn->findBlobStart(position) - m_DataOffset;
+	}
+
+	bool OSMFileIn::blobPrimitiveInfo(SizeType n, BlobIndexEntry & entry) const {
+		entry = m_BlobIndex->at(n);
+
+		if (m_BlobIndex->hasPrimitiveInfo() || entry.type != BLOB_OSMData)
+			return true;
+
+		return BlobIndex::readPrimitiveInfo(*m_FileIn, entry);
+	}
+
+	bool OSMFileIn::blobContains(SizeType n, PrimitiveType type, int64_t id) const {
+		BlobDataBuffer buffer;
+		PrimitiveBlockInputAdaptor pbi;
+
+		bool result = false;
+		if (m_FileIn->readBlobAt(m_BlobIndex->at(n).offset, buffer) == BLOB_OSMData) {
+			pbi.parseData(buffer.data, buffer.availableBytes);
+
+			switch (type) {
+			case NodePrimitive:
+				result = streamContains(pbi.getNodeStream(), id);
+				break;
+			case WayPrimitive:
+				result = streamContains(pbi.getWayStream(), id);
+				break;
+			case RelationPrimitive:
+				result = streamContains(pbi.getRelationStream(), id);
+				break;
+			default:
+				break;
+			}
+		}
+
+		BlobBufferPool::global().release(buffer);
+		return result;
+	}
+
 	bool OSMFileIn::parseHeader() {
 		m_FileIn->readBlob(m_DataBuffer);
 
@@ -1,6 +1,10 @@
 #include <osmpbf/pbistream.h>
 #include <osmpbf/osmfilein.h>
+#include <osmpbf/blobindex.h>
+#include <osmpbf/blobbufferpool.h>
+#include <osmpbf/primitiveblockinputadaptor.h>
 #include <cassert>
+#include <iostream>
 #include <limits>
 #include <algorithm>
 #include <stdexcept>
@@ -43,6 +47,21 @@ SingleFilePbiStream::size() const {
 	return m_file.dataSize();
 }
 
+SizeType
+SingleFilePbiStream::blobCount() {
+	return m_file.blobCount();
+}
+
+bool
+SingleFilePbiStream::seekBlob(SizeType n) {
+	return m_file.seekBlob(n);
+}
+
+SizeType
+SingleFilePbiStream::findBlobContaining(PrimitiveType type, int64_t id) {
+	return m_file.findBlobContaining(type, id);
+}
+
 bool
 SingleFilePbiStream::hasNext() const {
 	return m_file.hasNext();
@@ -53,6 +72,11 @@ SingleFilePbiStream::getNext(BlobDataBuffer& buffer) {
 	return m_file.getNextBlock(buffer);
 }
 
+bool
+SingleFilePbiStream::getNext(BlobDataBuffer& buffer, PrimitiveTypeFlags& wantedTypes) {
+	return m_file.getNextBlock(buffer, wantedTypes);
+}
+
 bool
 SingleFilePbiStream::getNext(osmpbf::BlobDataMultiBuffer& buffers, int num) {
 	return m_file.getNextBlocks(buffers, num);
@@ -65,59 +89,59 @@ SingleFilePbiStream::parseNext(PrimitiveBlockInputAdaptor& adaptor) {
 
 MultiFilePbiStream::~MultiFilePbiStream() {}
 
-const OSMFileIn&
-MultiFilePbiStream::currentFile() const {
-	return m_files[m_currentFile];
+void
+MultiFilePbiStream::buildBlobList() {
+	for(std::size_t i(0), s(m_files.size()); i < s; ++i) {
+		OSMFileIn & file = m_files[i];
+		//blobs without wanted primitives are left out instead of being decoded and dropped by getNext()
+		std::vector<SizeType> blobs;
+		if (!file.wantedBlobs(blobs)) {
+			//non-seekable inputs (pipes, stdin) can't be indexed, dropping their data would go unnoticed
+			throw std::runtime_error("osmpbf::PbiStream: could not index input file " + std::to_string(i));
+		}
+		SizeType dataOffset = file.totalSize() - file.dataSize();
+		for(SizeType n : blobs) {
+			const BlobIndexEntry & entry = file.blobIndex()->at(n);
+			m_blobs.push_back(BlobRef{uint32_t(i), entry.offset, m_clDataSize[i] + SizeType(entry.offset - dataOffset)});
+		}
+	}
 }
 
-OSMFileIn&
-MultiFilePbiStream::currentFile() {
-	return m_files[m_currentFile];
+SizeType
+MultiFilePbiStream::claimBlobs(SizeType count, SizeType & first) {
+	first = m_nextBlob.load(std::memory_order_relaxed);
+	SizeType last;
+	do {
+		if (first >= m_blobs.size()) {
+			return 0;
+		}
+		last = std::min<SizeType>(first + count, m_blobs.size());
+	} while (!m_nextBlob.compare_exchange_weak(first, last, std::memory_order_relaxed));
+	return last - first;
 }
 
+bool
+MultiFilePbiStream::readBlob(SizeType n, BlobDataBuffer & buffer) const {
+	return m_files[m_blobs[n].file].readBlobAt(m_blobs[n].offset, buffer);
+}
 
 void
 MultiFilePbiStream::reset() {
-	for(std::size_t i(0), s(std::min(m_currentFile+1, m_files.size())); i < s; ++i) {
-		m_files[i].reset();
-	}
-	m_position = 0;
-	m_currentFile = 0;
+	m_nextBlob = 0;
 }
 
 void
 MultiFilePbiStream::seek(osmpbf::SizeType position) {
-	if (position > m_dataSize) {
-		m_position = m_dataSize;
-		m_currentFile = m_files.size();
-		return;
-	}
-	if (position > m_position) {
-		m_position = m_clDataSize[m_currentFile];
-	}
-	else {
-		m_position = 0;
-		m_currentFile = 0;
-	}
-	while(m_currentFile < m_files.size()) {
-		m_position = m_clDataSize[m_currentFile];
-		if (m_position + currentFile().dataSize() < position) {
-			m_currentFile += 1;
-		}
-		else {
-			position -= m_position;
-			currentFile().dataSeek(position);
-			m_position += position;
-			break;
-		}
-	}
-	assert(m_position < m_dataSize);
-	assert(m_currentFile < m_files.size());
+	//first blob starting at or behind position
+	auto it = std::lower_bound(m_blobs.cbegin(), m_blobs.cend(), position,
+		[](const BlobRef & blob, SizeType value) { return blob.position < value; });
+	m_nextBlob = it - m_blobs.cbegin();
 }
 
 SizeType
 MultiFilePbiStream::position() const {
-	return m_position;
+	SizeType n = m_nextBlob.load(std::memory_order_relaxed);
+	return n < m_blobs.size() ? m_blobs[n].position : m_dataSize;
 }
 
 SizeType
@@ -125,54 +149,83 @@ MultiFilePbiStream::size() const {
 	return m_dataSize;
 }
 
+SizeType
+MultiFilePbiStream::blobCount() {
+	return m_blobs.size();
+}
+
+bool
+MultiFilePbiStream::seekBlob(SizeType n) {
+	if (n > m_blobs.size()) {
+		return false;
+	}
+	m_nextBlob = n;
+	return true;
+}
+
+SizeType
+MultiFilePbiStream::findBlobContaining(PrimitiveType type, int64_t id) {
+	for(std::size_t i(0), s(m_files.size()); i < s; ++i) {
+		OSMFileIn & file = m_files[i];
+		SizeType n = file.findBlobContaining(type, id);
+		if (n >= file.blobCount()) {
+			continue;
+		}
+		uint64_t offset = file.blobIndex()->at(n).offset;
+		//blobs left out by the primitive filter resolve to the next listed blob
+		auto it = std::lower_bound(m_blobs.cbegin(), m_blobs.cend(), BlobRef{uint32_t(i), offset, 0},
+			[](const BlobRef & a, const BlobRef & b) { return a.file < b.file || (a.file == b.file && a.offset < b.offset); });
+		return it - m_blobs.cbegin();
+	}
+	return m_blobs.size();
+}
+
 bool
 MultiFilePbiStream::hasNext() const {
-	return m_currentFile < m_files.size() && currentFile().hasNext();
+	return m_nextBlob.load(std::memory_order_relaxed) < m_blobs.size();
 }
 
 bool
 MultiFilePbiStream::getNext(BlobDataBuffer & buffer) {
-	std::lock_guard<std::mutex> lck(m_lock);
-	if (!hasNext()) {
-		return false;
-	}
-	bool ok = currentFile().getNextBlock(buffer);
-	if (!currentFile().hasNext()) {
-		m_currentFile += 1;
-		m_position = m_clDataSize.at(m_currentFile);
-		if (m_currentFile < m_files.size()) {
-			currentFile().reset();
+	PrimitiveTypeFlags wantedTypes;
+	return getNext(buffer, wantedTypes);
+}
+
+bool
+MultiFilePbiStream::getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) {
+	SizeType n;
+	while (claimBlobs(1, n)) {
+		if (!readBlob(n, buffer)) {
+			return false;
+		}
+		const OSMFileIn & file = m_files[m_blobs[n].file];
+		if (file.wantedBlock(buffer)) {
+			wantedTypes = file.primitiveTypes();
+			return true;
 		}
 	}
-	return ok;
+	buffer.type = BLOB_Invalid;
+	buffer.availableBytes = 0;
+	return false;
 }
 
 bool
 MultiFilePbiStream::getNext(osmpbf::BlobDataMultiBuffer & buffers, int num) {
-	std::lock_guard<std::mutex> lck(m_lock);
-	osmpbf::BlobDataMultiBuffer tmpBuffer;
 	if (num < 0) {
 		num = std::numeric_limits<int>::max();
 	}
-	while(hasNext() && buffers.size() < (std::size_t)num) {
-		int remNum = num-(int)buffers.size();
-		
-		currentFile().getNextBlocks(tmpBuffer, remNum);
-		
-		buffers.reserve(buffers.size() + tmpBuffer.size());
-		for(auto & x : tmpBuffer) {
-			buffers.emplace_back(std::move(x));
-		}
-		tmpBuffer.clear();
-		
-		if (currentFile().hasNext()) {
-			m_position = m_clDataSize.at(m_currentFile) + currentFile().dataPosition();
-		}
-		else {
-			m_currentFile += 1;
-			m_position = m_clDataSize.at(m_currentFile);
-			if (m_currentFile < m_files.size()) {
-				currentFile().reset();
+	SizeType first;
+	SizeType count;
+	while(buffers.size() < (std::size_t)num && (count = claimBlobs(num - (int)buffers.size(), first))) {
+		for(SizeType n(first), end(first+count); n < end; ++n) {
+			buffers.emplace_back();
+			if (!readBlob(n, buffers.back())) {
+				buffers.pop_back();
+				return false;
+			}
+			if (!m_files[m_blobs[n].file].wantedBlock(buffers.back())) {
+				BlobBufferPool::global().release(buffers.back());
+				buffers.pop_back();
 			}
 		}
 	}
@@ -181,19 +234,16 @@ MultiFilePbiStream::getNext(osmpbf::BlobDataMultiBuffer & buffers, int num) {
 
 bool
 MultiFilePbiStream::parseNext(PrimitiveBlockInputAdaptor& adaptor) {
-	std::lock_guard<std::mutex> lck(m_lock);
-	if (!hasNext()) {
+	BlobDataBuffer buffer;
+	PrimitiveTypeFlags wantedTypes;
+	if (!getNext(buffer, wantedTypes)) {
+		adaptor.clear();
+		BlobBufferPool::global().release(buffer);
 		return false;
 	}
-	bool ok = currentFile().parseNextBlock(adaptor);
-	if (!currentFile().hasNext()) {
-		m_currentFile += 1;
-		m_position = m_clDataSize.at(m_currentFile);
-		if (m_currentFile < m_files.size()) {
-			currentFile().reset();
-		}
-	}
-	return ok;
+	//the adaptor keeps the memory until its next block, lazy decoding refers to it
+	adaptor.parseData(std::move(buffer), false, wantedTypes);
+	return true;
 }
 
 
@@ -263,6 +313,27 @@ PbiStream::size() const {
 	return m_priv->size();
 }
 
+SizeType
+PbiStream::blobCount() {
+	return m_priv->blobCount();
+}
+
+bool
+PbiStream::seekBlob(SizeType n) {
+	return m_priv->seekBlob(n);
+}
+
+SizeType
+PbiStream::findBlobContaining(PrimitiveType type, int64_t id) {
+	return m_priv->findBlobContaining(type, id);
+}
+
+bool
+PbiStream::seekPrimitive(PrimitiveType type, int64_t id) {
+	SizeType n = findBlobContaining(type, id);
+	return n < blobCount() && seekBlob(n);
+}
+
 bool
 PbiStream::hasNext() const {
 	return m_priv->hasNext();
@@ -273,6 +344,11 @@ PbiStream::getNext(BlobDataBuffer & buffer) {
 	return m_priv->getNext(buffer);
 }
 
+bool
+PbiStream::getNext(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) {
+	return m_priv->getNext(buffer, wantedTypes);
+}
+
 bool
 PbiStream::getNext(BlobDataMultiBuffer & buffers, int num) {
 	return m_priv->getNext(buffers, num);
@@ -305,6 +381,11 @@ PbiStream::getNextBlock(BlobDataBuffer & buffer) {
 	return getNext(buffer);
 }
 
+bool
+PbiStream::getNextBlock(BlobDataBuffer & buffer, PrimitiveTypeFlags & wantedTypes) {
+	return getNext(buffer, wantedTypes);
+}
+
 bool
 PbiStream::getNextBlocks(BlobDataMultiBuffer & buffers, int num) {
 	return getNext(buffers, num);
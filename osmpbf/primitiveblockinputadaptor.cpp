@@ -27,26 +27,96 @@
 #include <osmpbf/irelation.h>
 
 #include <osmpbf/nodestreaminputadaptor.h>
+#include <osmpbf/primitivecursors.h>
+#include <osmpbf/blobbufferpool.h>
 
 #include "osmformat.pb.h"
+#include "wireformat.h"
+#include "deltacoding.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
 
 namespace osmpbf
 {
 
+namespace
+{
+
+///FNV-1a
+inline uint64_t hashString(const char * data, uint32_t length)
+{
+	uint64_t result = 14695981039346656037ULL;
+	for (uint32_t i = 0; i < length; ++i)
+	{
+		result ^= uint8_t(data[i]);
+		result *= 1099511628211ULL;
+	}
+
+	return result;
+}
+
+} // anonymous namespace
+
+// NodeColumns
+
+void NodeColumns::clear()
+{
+	ids.clear();
+	lats.clear();
+	lons.clear();
+	tagOffsets.clear();
+	keys.clear();
+	values.clear();
+}
+
+// NodeInfoColumns
+
+void NodeInfoColumns::clear()
+{
+	versions.clear();
+	timestamps.clear();
+	changesets.clear();
+	userIds.clear();
+	userStringIds.clear();
+}
+
+// WayRefs
+
+void WayRefs::clear()
+{
+	ids.clear();
+	refOffsets.clear();
+	refs.clear();
+	tagOffsets.clear();
+	keys.clear();
+	values.clear();
+}
+
 // PrimitiveBlockInputAdaptor
 
 PrimitiveBlockInputAdaptor::PrimitiveBlockInputAdaptor() :
 	m_PrimitiveBlock(nullptr),
+	m_PrimitiveBlockStorage(nullptr),
 	m_pc(0),
+	m_LazyDecoding(false),
+	m_LazyBlock(false),
+	m_UnpackDense(false),
+	m_WantedTypes(AllPrimitives),
+	m_DecodedTypes(NoPrimitive),
+	m_StringIndexBuilt(false),
 	m_PlainNodesCount(0),
 	m_DenseNodesCount(0),
 	m_WaysCount(0),
-	m_RelationsCount(0)
+	m_RelationsCount(0),
+	m_ColumnTypes(NoPrimitive),
+	m_OffsetTypes(NoPrimitive)
 {
 	GOOGLE_PROTOBUF_VERIFY_VERSION;
 }
 
-PrimitiveBlockInputAdaptor::PrimitiveBlockInputAdaptor(char * rawData, SizeType length, bool unpackDense) :
+PrimitiveBlockInputAdaptor::PrimitiveBlockInputAdaptor(const char * rawData, SizeType length, bool unpackDense) :
 PrimitiveBlockInputAdaptor()
 {
 	GOOGLE_PROTOBUF_VERIFY_VERSION;
@@ -56,48 +126,96 @@ PrimitiveBlockInputAdaptor()
 
 PrimitiveBlockInputAdaptor::~PrimitiveBlockInputAdaptor()
 {
-	delete m_PrimitiveBlock;
+	BlobBufferPool::global().release(m_DataBuffer);
+	delete m_PrimitiveBlockStorage;
 }
 
-void PrimitiveBlockInputAdaptor::parseData(char * rawData, SizeType length, bool unpackDense)
+void PrimitiveBlockInputAdaptor::clear()
 {
-	delete m_PrimitiveBlock;
 	++m_pc;
 
+	m_PrimitiveBlock = NULL;
+	BlobBufferPool::global().release(m_DataBuffer);
+
 	m_PlainNodesGroups.clear();
 	m_DenseNodesGroups.clear();
 	m_WaysGroups.clear();
 	m_RelationsGroups.clear();
 
-	m_PrimitiveBlock = new crosby::binary::PrimitiveBlock();
+	m_DecodedTypes = NoPrimitive;
+	m_StringRefs.clear();
+	m_LazyGroups.clear();
+	m_StringIndexBuilt = false;
+	m_ColumnTypes = NoPrimitive;
+	m_OffsetTypes = NoPrimitive;
+
+	m_PlainNodesCount = 0;
+	m_DenseNodesCount = 0;
+	m_WaysCount = 0;
+	m_RelationsCount = 0;
+}
+
+void PrimitiveBlockInputAdaptor::parseData(BlobDataBuffer && buffer, bool unpackDense, PrimitiveTypeFlags types)
+{
+	// releases the previous buffer, moving @buffer afterwards keeps its memory in place
+	parseData(buffer.data, buffer.availableBytes, unpackDense, types);
+	m_DataBuffer = std::move(buffer);
+}
+
+void PrimitiveBlockInputAdaptor::parseData(const char * rawData, SizeType length, bool unpackDense, PrimitiveTypeFlags types)
+{
+	clear();
+
+	m_LazyBlock = m_LazyDecoding;
+	m_UnpackDense = unpackDense;
+	m_WantedTypes = types;
+
+	// the message is reused for every block, cleared sub-messages and strings
+	// keep their memory so parsing reaches a steady state without allocations
+	if (!m_PrimitiveBlockStorage)
+		m_PrimitiveBlockStorage = new crosby::binary::PrimitiveBlock();
 
-	if (m_PrimitiveBlock->ParseFromArray((void*)rawData, length))
+	m_PrimitiveBlock = m_PrimitiveBlockStorage;
+
+	if (m_LazyBlock || types != AllPrimitives)
+	{
+		m_PrimitiveBlock->Clear();
+
+		if (indexBlock(rawData, length, types))
+		{
+			// eagerly parsed blocks must not refer to @rawData afterwards
+			if (!m_LazyBlock)
+			{
+				decodeGroups(types);
+				m_LazyGroups.clear();
+			}
+
+			return;
+		}
+
+		std::cerr << "ERROR: invalid OSM primitive block" << std::endl;
+
+		m_StringRefs.clear();
+		m_LazyGroups.clear();
+
+		m_PrimitiveBlock = NULL;
+	}
+	else if (m_PrimitiveBlock->ParseFromArray(rawData, length))
 	{
 		// we assume each primitive block has one primitive group for each primitive type
 		// populate group refs
 		crosby::binary::PrimitiveGroup ** primGroups = m_PrimitiveBlock->mutable_primitivegroup()->mutable_data();
 
 		for (int i = 0; i < m_PrimitiveBlock->primitivegroup_size(); ++i) {
-			if (primGroups[i]->nodes_size()) {
-				m_PlainNodesCount += primGroups[i]->nodes_size();
-				m_PlainNodesGroups.push_back(primGroups[i]);
-			}
+			m_PlainNodesCount += primGroups[i]->nodes_size();
+			m_DenseNodesCount += primGroups[i]->dense().id_size();
+			m_WaysCount += primGroups[i]->ways_size();
+			m_RelationsCount += primGroups[i]->relations_size();
 
-			if (primGroups[i]->has_dense()) {
-				m_DenseNodesCount += primGroups[i]->dense().id_size();
-				m_DenseNodesGroups.push_back(DenseNodesData(primGroups[i], unpackDense));
-			}
-
-			if (primGroups[i]->ways_size()) {
-				m_WaysCount += primGroups[i]->ways_size();
-				m_WaysGroups.push_back(primGroups[i]);
-			}
-
-			if (primGroups[i]->relations_size()) {
-				m_RelationsCount += primGroups[i]->relations_size();
-				m_RelationsGroups.push_back(primGroups[i]);
-			}
+			addGroup(primGroups[i], AllPrimitives);
 		}
+
+		m_DecodedTypes = AllPrimitives;
 	}
 	else
 	{
@@ -105,21 +223,315 @@ void PrimitiveBlockInputAdaptor::parseData(char * rawData, SizeType length, bool
 		if (!m_PrimitiveBlock->has_stringtable())
 			std::cerr << "no stringtable field found" << std::endl;
 
-		delete m_PrimitiveBlock;
 		m_PrimitiveBlock = NULL;
 	}
 }
 
-//	INode PrimitiveBlockInputAdaptor::getNodeAt(int position) const {
-//		if (!m_PlainNodesGroup && !m_DenseNodesGroup)
-//			return INode();
+bool PrimitiveBlockInputAdaptor::indexBlock(const char * rawData, SizeType length, PrimitiveTypeFlags types)
+{
+	const uint8_t * pos = reinterpret_cast<const uint8_t *>(rawData);
+	const uint8_t * end = pos + length;
+
+	int plainNodesCount = 0;
+	int denseNodesCount = 0;
+	int waysCount = 0;
+	int relationsCount = 0;
+
+	bool hasStringTable = false;
+
+	while (pos < end)
+	{
+		uint64_t key, value;
+		if (!readVarint(pos, end, key))
+			return false;
+
+		switch (key)
+		{
+		case (1 << 3) | WIRE_LengthDelimited: // stringtable
+			{
+				const uint8_t * tablePos;
+				if (!readLengthDelimited(pos, end, tablePos, value))
+					return false;
+
+				hasStringTable = true;
+
+				if (!m_LazyBlock)
+				{
+					if (!m_PrimitiveBlock->mutable_stringtable()->ParseFromArray(tablePos, int(value)))
+						return false;
+					break;
+				}
+
+				const uint8_t * tableEnd = tablePos + value;
+				while (tablePos < tableEnd)
+				{
+					if (!readVarint(tablePos, tableEnd, key))
+						return false;
+
+					const uint8_t * stringData;
+					if (key == ((1 << 3) | WIRE_LengthDelimited))
+					{
+						if (!readLengthDelimited(tablePos, tableEnd, stringData, value))
+							return false;
+
+						m_StringRefs.push_back(StringRef{reinterpret_cast<const char *>(stringData), uint32_t(value)});
+					}
+					else if (!skipField(key, tablePos, tableEnd))
+					{
+						return false;
+					}
+				}
+			}
+			break;
+		case (2 << 3) | WIRE_LengthDelimited: // primitivegroup
+			{
+				const uint8_t * groupData;
+				if (!readLengthDelimited(pos, end, groupData, value))
+					return false;
+
+				LazyGroup group{reinterpret_cast<const char *>(groupData), uint32_t(value), NoPrimitive, NULL};
+
+				int groupPlainNodes = 0;
+				int groupDenseNodes = 0;
+				int groupWays = 0;
+				int groupRelations = 0;
+
+				const uint8_t * groupPos = groupData;
+				const uint8_t * groupEnd = groupData + value;
+				while (groupPos < groupEnd)
+				{
+					if (!readVarint(groupPos, groupEnd, key))
+						return false;
+
+					switch (key)
+					{
+					case (1 << 3) | WIRE_LengthDelimited: // nodes
+						group.types |= NodePrimitive;
+						++groupPlainNodes;
+						break;
+					case (2 << 3) | WIRE_LengthDelimited: // dense
+						group.types |= NodePrimitive;
+
+						// only count the ids of wanted nodes, they are decoded with the group
+						if (types & NodePrimitive)
+						{
+							const uint8_t * densePos;
+							if (!readLengthDelimited(groupPos, groupEnd, densePos, value))
+								return false;
+
+							const uint8_t * denseEnd = densePos + value;
+							while (densePos < denseEnd)
+							{
+								if (!readVarint(densePos, denseEnd, key))
+									return false;
+
+								const uint8_t * ids;
+								if (key == ((1 << 3) | WIRE_LengthDelimited))
+								{
+									if (!readLengthDelimited(densePos, denseEnd, ids, value))
+										return false;
+
+									groupDenseNodes += countVarints(ids, ids + value);
+								}
+								else
+								{
+									if (key == ((1 << 3) | WIRE_Varint))
+										++groupDenseNodes;
+
+									if (!skipField(key, densePos, denseEnd))
+										return false;
+								}
+							}
+
+							continue;
+						}
+						break;
+					case (3 << 3) | WIRE_LengthDelimited: // ways
+						group.types |= WayPrimitive;
+						++groupWays;
+						break;
+					case (4 << 3) | WIRE_LengthDelimited: // relations
+						group.types |= RelationPrimitive;
+						++groupRelations;
+						break;
+					default:
+						break;
+					}
+
+					if (!skipField(key, groupPos, groupEnd))
+						return false;
+				}
+
+				// unwanted groups are skipped as a whole
+				group.types &= types;
+				if (group.types == NoPrimitive)
+					break;
+
+				m_LazyGroups.push_back(group);
+
+				if (group.types & NodePrimitive)
+				{
+					plainNodesCount += groupPlainNodes;
+					denseNodesCount += groupDenseNodes;
+				}
+
+				if (group.types & WayPrimitive)
+					waysCount += groupWays;
+
+				if (group.types & RelationPrimitive)
+					relationsCount += groupRelations;
+			}
+			break;
+		case (17 << 3) | WIRE_Varint:
+			if (!readVarint(pos, end, value))
+				return false;
+			m_PrimitiveBlock->set_granularity(int32_t(value));
+			break;
+		case (18 << 3) | WIRE_Varint:
+			if (!readVarint(pos, end, value))
+				return false;
+			m_PrimitiveBlock->set_date_granularity(int32_t(value));
+			break;
+		case (19 << 3) | WIRE_Varint:
+			if (!readVarint(pos, end, value))
+				return false;
+			m_PrimitiveBlock->set_lat_offset(int64_t(value));
+			break;
+		case (20 << 3) | WIRE_Varint:
+			if (!readVarint(pos, end, value))
+				return false;
+			m_PrimitiveBlock->set_lon_offset(int64_t(value));
+			break;
+		default:
+			if (!skipField(key, pos, end))
+				return false;
+			break;
+		}
+	}
+
+	if (!hasStringTable)
+		return false;
+
+	if (m_LazyBlock)
+	{
+		m_Strings.resize(m_StringRefs.size());
+		m_StringsDecoded.assign(m_StringRefs.size(), false);
+	}
+
+	m_PlainNodesCount = plainNodesCount;
+	m_DenseNodesCount = denseNodesCount;
+	m_WaysCount = waysCount;
+	m_RelationsCount = relationsCount;
+
+	return true;
+}
+
+void PrimitiveBlockInputAdaptor::decodeGroups(PrimitiveTypeFlags types)
+{
+	types &= m_WantedTypes & ~m_DecodedTypes;
+	if (types == NoPrimitive)
+		return;
+
+	m_DecodedTypes |= types;
+
+	for (LazyGroup & lazyGroup : m_LazyGroups)
+	{
+		if (!(lazyGroup.types & types))
+			continue;
+
+		if (!lazyGroup.group)
+		{
+			crosby::binary::PrimitiveGroup * group = m_PrimitiveBlock->add_primitivegroup();
+
+			if (!group->ParseFromArray(lazyGroup.data, lazyGroup.length))
+			{
+				std::cerr << "ERROR: invalid OSM primitive group" << std::endl;
+
+				m_PrimitiveBlock->mutable_primitivegroup()->RemoveLast();
+				lazyGroup.types = NoPrimitive;
+				continue;
+			}
+
+			lazyGroup.group = group;
+		}
+
+		addGroup(lazyGroup.group, types);
+	}
+}
+
+void PrimitiveBlockInputAdaptor::addGroup(crosby::binary::PrimitiveGroup * group, PrimitiveTypeFlags types)
+{
+	if (types & NodePrimitive) {
+		if (group->nodes_size())
+			m_PlainNodesGroups.push_back(group);
+
+		if (group->has_dense())
+			m_DenseNodesGroups.push_back(DenseNodesData(group, m_UnpackDense));
+	}
+
+	if ((types & WayPrimitive) && group->ways_size())
+		m_WaysGroups.push_back(group);
+
+	if ((types & RelationPrimitive) && group->relations_size())
+		m_RelationsGroups.push_back(group);
+}
+
+const std::vector<int> & PrimitiveBlockInputAdaptor::groupOffsets(PrimitiveType type)
+{
+	std::vector<int> & offsets = (type == NodePrimitive) ? m_NodeGroupOffsets :
+		((type == WayPrimitive) ? m_WayGroupOffsets : m_RelationGroupOffsets);
+
+	if (m_OffsetTypes & type)
+		return offsets;
+
+	decodeGroups(type);
+
+	offsets.assign(1, 0);
+
+	switch (type)
+	{
+	case NodePrimitive:
+		for (crosby::binary::PrimitiveGroup * group : m_PlainNodesGroups)
+			offsets.push_back(offsets.back() + group->nodes_size());
+
+		for (DenseNodesData & denseData : m_DenseNodesGroups)
+			offsets.push_back(offsets.back() + denseData.group()->dense().id_size());
+		break;
+	case WayPrimitive:
+		for (crosby::binary::PrimitiveGroup * group : m_WaysGroups)
+			offsets.push_back(offsets.back() + group->ways_size());
+		break;
+	case RelationPrimitive:
+		for (crosby::binary::PrimitiveGroup * group : m_RelationsGroups)
+			offsets.push_back(offsets.back() + group->relations_size());
+		break;
+	default:
+		break;
+	}
+
+	m_OffsetTypes |= type;
+
+	return offsets;
+}
+
+int PrimitiveBlockInputAdaptor::findGroup(PrimitiveType type, int position, int & index)
+{
+	const std::vector<int> & offsets = groupOffsets(type);
+
+	if (position < 0 || position >= offsets.back())
+		return -1;
 
-//		if (m_DenseNodesGroup && (!m_PlainNodesGroup || (position > m_PlainNodesGroup->nodes_size())))
-//			return INode(new DenseNodeInputAdaptor(const_cast<PrimitiveBlockInputAdaptor *>(this), m_DenseNodesGroup->dense(), position));
-//		else
-//			return INode(new PlainNodeInputAdaptor(const_cast<PrimitiveBlockInputAdaptor *>(this), m_PlainNodesGroup->nodes(position)));
+	// last group starting at or before @position, empty groups are skipped as they share their offset with the next one
+	const int group = std::upper_bound(offsets.begin(), offsets.end(), position) - offsets.begin() - 1;
 
-//	}
+	index = position - offsets[group];
+	return group;
+}
+
+INode PrimitiveBlockInputAdaptor::getNodeAt(int position)
+{
+	return INode(new NodeStreamInputAdaptor(this, position));
+}
 
 int PrimitiveBlockInputAdaptor::nodesSize(unsigned char type) const
 {
@@ -134,18 +546,26 @@ int PrimitiveBlockInputAdaptor::nodesSize(unsigned char type) const
 	return result;
 }
 
-//	IWay PrimitiveBlockInputAdaptor::getWayAt(int position) const {
-//		return IWay(new WayInputAdaptor(const_cast<PrimitiveBlockInputAdaptor *>(this), m_WaysGroup->ways().data()[position]));
-//	}
+IWay PrimitiveBlockInputAdaptor::getWayAt(int position)
+{
+	int index;
+	const int group = findGroup(WayPrimitive, position, index);
+
+	return IWay(new WayInputAdaptor(this, (group < 0) ? NULL : &m_WaysGroups[group]->ways(index)));
+}
 
 int PrimitiveBlockInputAdaptor::waysSize() const
 {
 	return m_WaysCount;
 }
 
-//	IRelation PrimitiveBlockInputAdaptor::getRelationAt(int position) const {
-//		return IRelation(new RelationInputAdaptor(const_cast<PrimitiveBlockInputAdaptor *>(this), m_RelationsGroup->relations().data()[position]));
-//	}
+IRelation PrimitiveBlockInputAdaptor::getRelationAt(int position)
+{
+	int index;
+	const int group = findGroup(RelationPrimitive, position, index);
+
+	return IRelation(new RelationInputAdaptor(this, (group < 0) ? NULL : &m_RelationsGroups[group]->relations(index)));
+}
 
 int PrimitiveBlockInputAdaptor::relationsSize() const
 {
@@ -157,6 +577,11 @@ int32_t PrimitiveBlockInputAdaptor::granularity() const
 	return m_PrimitiveBlock->granularity();
 }
 
+int32_t PrimitiveBlockInputAdaptor::dateGranularity() const
+{
+	return m_PrimitiveBlock->date_granularity();
+}
+
 int64_t PrimitiveBlockInputAdaptor::latOffset() const
 {
 	return m_PrimitiveBlock->lat_offset();
@@ -184,39 +609,312 @@ PrimitiveBlockInputAdaptor::IdType PrimitiveBlockInputAdaptor::id() const
 
 const std::string & PrimitiveBlockInputAdaptor::queryStringTable(int id) const
 {
-	return m_PrimitiveBlock->stringtable().s(id);
+	if (!m_LazyBlock)
+		return m_PrimitiveBlock->stringtable().s(id);
+
+	if (!m_StringsDecoded[id])
+	{
+		m_Strings[id].assign(m_StringRefs[id].data, m_StringRefs[id].length);
+		m_StringsDecoded[id] = true;
+	}
+
+	return m_Strings[id];
 }
 
 int PrimitiveBlockInputAdaptor::stringTableSize() const
 {
+	if (m_LazyBlock)
+		return m_StringRefs.size();
+
 	return m_PrimitiveBlock->stringtable().s_size();
 }
 
-int PrimitiveBlockInputAdaptor::findString(const std::string & str) const
+int PrimitiveBlockInputAdaptor::findString(const std::string & str, int previous) const
 {
 	if (isNull())
 		return 0;
 
-	int size = stringTableSize();
+	if (!m_StringIndexBuilt)
+		buildStringIndex();
 
-	for (int id = 1; id < size; ++id) {
-		if (str == queryStringTable(id))
+	const std::size_t mask = m_StringIndex.size() - 1;
+
+	for (std::size_t slot = hashString(str.data(), str.size()) & mask; m_StringIndex[slot]; slot = (slot + 1) & mask) {
+		int id = m_StringIndex[slot];
+		if (id <= previous)
+			continue;
+
+		StringRef ref = stringRef(id);
+		if (ref.length == str.size() && !::memcmp(ref.data, str.data(), str.size()))
 			return id;
 	}
 
 	return 0;
 }
 
+PrimitiveBlockInputAdaptor::StringRef PrimitiveBlockInputAdaptor::stringRef(int id) const
+{
+	if (m_LazyBlock)
+		return m_StringRefs[id];
+
+	const std::string & str = m_PrimitiveBlock->stringtable().s(id);
+	return StringRef{str.data(), uint32_t(str.size())};
+}
+
+void PrimitiveBlockInputAdaptor::buildStringIndex() const
+{
+	int size = stringTableSize();
+
+	// keep the load factor below 0.5
+	std::size_t capacity = 16;
+	while (capacity < std::size_t(size) * 2)
+		capacity <<= 1;
+
+	m_StringIndex.assign(capacity, 0);
+
+	const std::size_t mask = capacity - 1;
+
+	// id 0 is the empty string used as delimiter and never looked up
+	// ids are inserted in order, so duplicates are probed in ascending order like a linear search would
+	for (int id = 1; id < size; ++id) {
+		StringRef ref = stringRef(id);
+
+		std::size_t slot = hashString(ref.data, ref.length) & mask;
+		while (m_StringIndex[slot])
+			slot = (slot + 1) & mask;
+
+		m_StringIndex[slot] = id;
+	}
+
+	m_StringIndexBuilt = true;
+}
+
 INodeStream PrimitiveBlockInputAdaptor::getNodeStream()
 {
 	return INodeStream(this);
 }
 
+void PrimitiveBlockInputAdaptor::getNodeColumns(NodeColumns & columns, NodeTypeFlags type)
+{
+	columns.clear();
+
+	if (!m_PrimitiveBlock)
+		return;
+
+	decodeGroups(NodePrimitive);
+
+	const SizeType count = nodesSize(type);
+
+	columns.ids.reserve(count);
+	columns.lats.reserve(count);
+	columns.lons.reserve(count);
+	columns.tagOffsets.reserve(count + 1);
+	columns.tagOffsets.push_back(0);
+
+	if (type & PlainNode) {
+		for (crosby::binary::PrimitiveGroup * group : m_PlainNodesGroups) {
+			for (const crosby::binary::Node & node : group->nodes()) {
+				columns.ids.push_back(node.id());
+				columns.lats.push_back(node.lat());
+				columns.lons.push_back(node.lon());
+
+				// unpaired keys or values of malformed nodes are dropped, both columns share tagOffsets
+				const int tagCount = std::min(node.keys_size(), node.vals_size());
+				columns.keys.insert(columns.keys.end(), node.keys().begin(), node.keys().begin() + tagCount);
+				columns.values.insert(columns.values.end(), node.vals().begin(), node.vals().begin() + tagCount);
+				columns.tagOffsets.push_back(columns.keys.size());
+			}
+		}
+	}
+
+	if (type & DenseNode) {
+		for (DenseNodesData & denseData : m_DenseNodesGroups) {
+			const crosby::binary::DenseNodes & dense = denseData.group()->dense();
+			const SizeType first = columns.ids.size();
+			const int size = dense.id_size();
+
+			// malformed groups keep their rows, they have to match nodesSize() and NodeInfoColumns
+			const bool coordinates = dense.lat_size() == size && dense.lon_size() == size;
+			if (!coordinates)
+				std::cerr << "ERROR: invalid dense nodes, column sizes differ" << std::endl;
+
+			columns.ids.insert(columns.ids.end(), dense.id().begin(), dense.id().end());
+			if (coordinates) {
+				columns.lats.insert(columns.lats.end(), dense.lat().begin(), dense.lat().end());
+				columns.lons.insert(columns.lons.end(), dense.lon().begin(), dense.lon().end());
+			}
+			else {
+				columns.lats.resize(columns.lats.size() + size, 0);
+				columns.lons.resize(columns.lons.size() + size, 0);
+			}
+
+			if (!denseData.isDataUnpacked()) {
+				decodeDeltas(columns.ids.data() + first, size);
+				if (coordinates) {
+					decodeDeltas(columns.lats.data() + first, size);
+					decodeDeltas(columns.lons.data() + first, size);
+				}
+			}
+
+			// keys_vals holds key value pairs of each node terminated by 0, it's empty if no node has tags
+			const int keysValsSize = dense.keys_vals_size();
+			int keyVal = 0;
+			for (int i = 0; i < size; ++i) {
+				while (keyVal + 1 < keysValsSize && dense.keys_vals(keyVal)) {
+					columns.keys.push_back(dense.keys_vals(keyVal));
+					columns.values.push_back(dense.keys_vals(keyVal + 1));
+					keyVal += 2;
+				}
+
+				++keyVal;
+				columns.tagOffsets.push_back(columns.keys.size());
+			}
+		}
+	}
+
+	// raw coordinates to nanodegrees
+	const int64_t granularity = this->granularity();
+	const int64_t latOffset = this->latOffset();
+	const int64_t lonOffset = this->lonOffset();
+
+	for (int64_t & lat : columns.lats)
+		lat = latOffset + granularity * lat;
+
+	for (int64_t & lon : columns.lons)
+		lon = lonOffset + granularity * lon;
+
+	// row i has to be node i of getNodeInfoColumns() and getNodeAt()
+	assert(columns.size() == count && columns.lats.size() == count && columns.lons.size() == count);
+}
+
+void PrimitiveBlockInputAdaptor::getNodeInfoColumns(NodeInfoColumns & columns, NodeTypeFlags type)
+{
+	columns.clear();
+
+	if (!m_PrimitiveBlock)
+		return;
+
+	decodeGroups(NodePrimitive);
+
+	const SizeType count = nodesSize(type);
+
+	columns.versions.reserve(count);
+	columns.timestamps.reserve(count);
+	columns.changesets.reserve(count);
+	columns.userIds.reserve(count);
+	columns.userStringIds.reserve(count);
+
+	if (type & PlainNode) {
+		for (crosby::binary::PrimitiveGroup * group : m_PlainNodesGroups) {
+			for (const crosby::binary::Node & node : group->nodes()) {
+				const IInfo info = node.has_info() ? IInfo(node.info()) : IInfo();
+
+				columns.versions.push_back(info.version());
+				columns.timestamps.push_back(info.timestamp());
+				columns.changesets.push_back(info.changeset());
+				columns.userIds.push_back(info.userId());
+				columns.userStringIds.push_back(info.userStringId());
+			}
+		}
+	}
+
+	if (type & DenseNode) {
+		for (DenseNodesData & denseData : m_DenseNodesGroups) {
+			const crosby::binary::DenseNodes & dense = denseData.group()->dense();
+			const crosby::binary::DenseInfo & denseInfo = dense.denseinfo();
+			const SizeType first = columns.size();
+			const int size = dense.id_size();
+
+			// copy each column as a whole or mark it missing, a partial column would misalign the nodes
+			auto appendColumn = [size](auto & dest, const auto & source) {
+				if (source.size() == size)
+					dest.insert(dest.end(), source.begin(), source.end());
+				else
+					dest.resize(dest.size() + size, -1);
+			};
+
+			appendColumn(columns.versions, denseInfo.version());
+			appendColumn(columns.timestamps, denseInfo.timestamp());
+			appendColumn(columns.changesets, denseInfo.changeset());
+			appendColumn(columns.userIds, denseInfo.uid());
+			appendColumn(columns.userStringIds, denseInfo.user_sid());
+
+			if (!denseData.isInfoUnpacked()) {
+				if (denseInfo.timestamp_size() == size)
+					decodeDeltas(columns.timestamps.data() + first, size);
+				if (denseInfo.changeset_size() == size)
+					decodeDeltas(columns.changesets.data() + first, size);
+				if (denseInfo.uid_size() == size)
+					decodeDeltas(columns.userIds.data() + first, size);
+				if (denseInfo.user_sid_size() == size)
+					decodeDeltas(columns.userStringIds.data() + first, size);
+			}
+		}
+	}
+
+	// every group keeps its rows like in getNodeColumns(), even with malformed columns
+	assert(columns.size() == count);
+}
+
 IWayStream PrimitiveBlockInputAdaptor::getWayStream()
 {
 	return IWayStream(this);
 }
 
+void PrimitiveBlockInputAdaptor::getWayRefs(WayRefs & refs)
+{
+	refs.clear();
+
+	if (!m_PrimitiveBlock)
+		return;
+
+	decodeGroups(WayPrimitive);
+
+	refs.ids.reserve(m_WaysCount);
+	refs.refOffsets.reserve(m_WaysCount + 1);
+	refs.refOffsets.push_back(0);
+	refs.tagOffsets.reserve(m_WaysCount + 1);
+	refs.tagOffsets.push_back(0);
+
+	for (crosby::binary::PrimitiveGroup * group : m_WaysGroups) {
+		for (const crosby::binary::Way & way : group->ways()) {
+			refs.ids.push_back(way.id());
+			refs.refs.insert(refs.refs.end(), way.refs().begin(), way.refs().end());
+			refs.refOffsets.push_back(refs.refs.size());
+
+			// unpaired keys or values of malformed ways are dropped, both columns share tagOffsets
+			const int tagCount = std::min(way.keys_size(), way.vals_size());
+			refs.keys.insert(refs.keys.end(), way.keys().begin(), way.keys().begin() + tagCount);
+			refs.values.insert(refs.values.end(), way.vals().begin(), way.vals().begin() + tagCount);
+			refs.tagOffsets.push_back(refs.keys.size());
+		}
+	}
+
+	// each way starts its own delta chain
+	for (SizeType i = 0, s = refs.size(); i < s; ++i)
+		decodeDeltas(refs.refs.data() + refs.refOffsets[i], refs.refsSize(i));
+}
+
+NodeRange PrimitiveBlockInputAdaptor::nodes()
+{
+	if (!(m_ColumnTypes & NodePrimitive)) {
+		getNodeColumns(m_NodeColumns);
+		m_ColumnTypes |= NodePrimitive;
+	}
+
+	return NodeRange(this, &m_NodeColumns);
+}
+
+WayRange PrimitiveBlockInputAdaptor::ways()
+{
+	if (!(m_ColumnTypes & WayPrimitive)) {
+		getWayRefs(m_WayRefs);
+		m_ColumnTypes |= WayPrimitive;
+	}
+
+	return WayRange(this, &m_WayRefs);
+}
+
 IRelationStream PrimitiveBlockInputAdaptor::getRelationStream()
 {
 	return IRelationStream(this);
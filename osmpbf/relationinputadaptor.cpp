@@ -138,9 +138,11 @@ IMemberStream RelationInputAdaptor::getMemberStream() const
 RelationStreamInputAdaptor::RelationStreamInputAdaptor() : RelationInputAdaptor(), m_Index(0) {}
 RelationStreamInputAdaptor::RelationStreamInputAdaptor(PrimitiveBlockInputAdaptor * controller)
 	: RelationInputAdaptor(controller, nullptr),
-	  m_Index(-1),
-	  m_GroupIterator(m_Controller->m_RelationsGroups.begin())
+	  m_Index(-1)
 {
+	m_Controller->decodeGroups(RelationPrimitive);
+	m_GroupIterator = m_Controller->m_RelationsGroups.begin();
+
 	next();
 }
 
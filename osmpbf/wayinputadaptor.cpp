@@ -22,6 +22,9 @@
 #include <osmpbf/primitiveblockinputadaptor.h>
 
 #include "osmformat.pb.h"
+#include "deltacoding.h"
+
+#include <cstring>
 
 namespace osmpbf
 {
@@ -66,6 +69,15 @@ int64_t WayInputAdaptor::rawRef(int index) const
 	return m_Data->refs(index);
 }
 
+void WayInputAdaptor::decodeRefs(int64_t * dest) const
+{
+	if (!m_Data->refs_size())
+		return;
+
+	::memcpy(dest, m_Data->refs().data(), m_Data->refs_size() * sizeof(int64_t));
+	decodeDeltas(dest, m_Data->refs_size());
+}
+
 RefIterator WayInputAdaptor::refBegin() const
 {
 	return RefIterator(m_Data->refs().data());
@@ -96,7 +108,7 @@ bool WayInputAdaptor::hasInfo() const {
 }
 
 IInfo WayInputAdaptor::info() const {
-	if (hasInfo())
+	if (!hasInfo())
 	{
 		return IInfo();
 	}
@@ -122,9 +134,11 @@ void WayInputAdaptor::print(std::ostream& out) const
 WayStreamInputAdaptor::WayStreamInputAdaptor() : WayInputAdaptor(), m_Index(-1) {}
 WayStreamInputAdaptor::WayStreamInputAdaptor(PrimitiveBlockInputAdaptor * controller)
 	: WayInputAdaptor(controller, nullptr),
-	  m_Index(-1),
-	  m_GroupIterator(m_Controller->m_WaysGroups.begin())
+	  m_Index(-1)
 {
+	m_Controller->decodeGroups(WayPrimitive);
+	m_GroupIterator = m_Controller->m_WaysGroups.begin();
+
 	next();
 }
 
@@ -0,0 +1,104 @@
+/*
+    This file is part of the osmpbf library.
+
+    Copyright(c) 2012-2014 Oliver Groß.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 3 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, see
+    <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OSMPBF_WIREFORMAT_H
+#define OSMPBF_WIREFORMAT_H
+
+#include <cstdint>
+
+// internal header, not installed
+
+namespace osmpbf
+{
+
+/// protobuf wire types used by the hand-written scanners
+enum WireType { WIRE_Varint = 0, WIRE_Fixed64 = 1, WIRE_LengthDelimited = 2, WIRE_Fixed32 = 5 };
+
+inline bool readVarint(const uint8_t * & data, const uint8_t * end, uint64_t & value)
+{
+	value = 0;
+	for (int shift = 0; data < end && shift < 64; shift += 7)
+	{
+		uint8_t byte = *data++;
+		value |= uint64_t(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
+/**
+ * read the length of a length delimited field and advance @data past its payload
+ *
+ * @param payload start of the payload
+ * @return false if the length is invalid or exceeds @end
+ */
+inline bool readLengthDelimited(const uint8_t * & data, const uint8_t * end, const uint8_t * & payload, uint64_t & length)
+{
+	if (!readVarint(data, end, length) || length > uint64_t(end - data))
+		return false;
+
+	payload = data;
+	data += length;
+	return true;
+}
+
+///skip the value of a field with @key, @return false on truncated or unsupported data
+inline bool skipField(uint64_t key, const uint8_t * & data, const uint8_t * end)
+{
+	uint64_t value;
+	switch (key & 0x7)
+	{
+	case WIRE_Varint:
+		return readVarint(data, end, value);
+	case WIRE_LengthDelimited:
+		if (!readVarint(data, end, value) || value > uint64_t(end - data))
+			return false;
+		data += value;
+		return true;
+	case WIRE_Fixed64:
+		if (end - data < 8)
+			return false;
+		data += 8;
+		return true;
+	case WIRE_Fixed32:
+		if (end - data < 4)
+			return false;
+		data += 4;
+		return true;
+	default:
+		return false;
+	}
+}
+
+///number of varints in the packed field payload [@data, @end)
+inline uint32_t countVarints(const uint8_t * data, const uint8_t * end)
+{
+	uint32_t result = 0;
+	for (; data < end; ++data)
+		result += !(*data & 0x80);
+
+	return result;
+}
+
+} // namespace osmpbf
+
+#endif // OSMPBF_WIREFORMAT_H